@@ -0,0 +1,93 @@
+# -*- coding: utf-8 -*-
+
+"""
+Compares the peak decision diagram size (and the simulation time) for the
+declaration order of the qubits with the order derived from the interaction
+graph of the circuit (--qubit_order interaction).
+
+usage: python3 order_bench.py [path to jku_simulator] [number of qubits]
+"""
+
+import os
+import random
+import re
+import subprocess
+import sys
+import tempfile
+
+
+def header(n):
+    # only the built-in gates U and CX are used, such that no qelib1.inc is required
+    return ['OPENQASM 2.0;', 'qreg q[%d];' % n, 'creg c[%d];' % n]
+
+
+def distant_pairs(n):
+    """Entangles qubit i with qubit i+n/2 (exponential in declaration order)."""
+    lines = header(n)
+    half = n // 2
+    for i in range(half):
+        lines.append('U(%f,0.2,0.1) q[%d];' % (0.3 + 0.1 * i, i))
+        lines.append('CX q[%d],q[%d];' % (i, i + half))
+    for i in range(half):
+        lines.append('U(0,0,pi/4) q[%d];' % (i + half))
+        lines.append('CX q[%d],q[%d];' % (i + half, (i + 1) % half))
+    return lines
+
+
+def shuffled_cluster(n):
+    """Linear cluster state on a chain whose qubits are declared in random order."""
+    rnd = random.Random(42)
+    perm = list(range(n))
+    rnd.shuffle(perm)
+    lines = header(n)
+    for q in range(n):
+        lines.append('U(pi/2,0,pi) q[%d];' % q)
+    for i in range(n - 1):
+        # CZ = (I x H) CX (I x H)
+        lines.append('U(pi/2,0,pi) q[%d];' % perm[i + 1])
+        lines.append('CX q[%d],q[%d];' % (perm[i], perm[i + 1]))
+        lines.append('U(pi/2,0,pi) q[%d];' % perm[i + 1])
+    return lines
+
+
+def random_pairs(n, gates=None):
+    """Gates between random pairs of qubits (no structure to exploit)."""
+    rnd = random.Random(7)
+    lines = header(n)
+    for _ in range(gates or 2 * n):
+        a, b = rnd.sample(range(n), 2)
+        lines.append('U(pi/2,0,pi) q[%d];' % a)
+        lines.append('CX q[%d],q[%d];' % (a, b))
+    return lines
+
+
+def run(simulator, fname, order):
+    out = subprocess.run([simulator, '--simulate_qasm', fname, '--shots', '1',
+                          '--seed', '1', '--ps', '--qubit_order', order],
+                         stdout=subprocess.PIPE, universal_newlines=True).stdout
+    nodes = int(re.search(r'Maximal size of DD.*: (\d+)', out).group(1))
+    seconds = float(re.search(r'Simulation time: ([0-9.e+-]+)', out).group(1))
+    return nodes, seconds
+
+
+def main():
+    simulator = os.path.abspath(sys.argv[1] if len(sys.argv) > 1 else 'jku_simulator')
+    n = int(sys.argv[2]) if len(sys.argv) > 2 else 20
+
+    print('%-16s %12s %10s %12s %10s' % ('circuit', 'decl. nodes', 'time',
+                                         'inter. nodes', 'time'))
+    with tempfile.TemporaryDirectory() as tmp:
+        for name, gen in [('distant_pairs', distant_pairs),
+                          ('shuffled_cluster', shuffled_cluster),
+                          ('random_pairs', random_pairs)]:
+            fname = os.path.join(tmp, name + '.qasm')
+            with open(fname, 'w') as f:
+                f.write('\n'.join(gen(n)) + '\n')
+            decl = run(simulator, fname, 'declaration')
+            inter = run(simulator, fname, 'interaction')
+            print('%-16s %12d %9.3fs %12d %9.3fs' % (name, decl[0], decl[1],
+                                                     inter[0], inter[1]))
+
+
+if __name__ == '__main__':
+    main()
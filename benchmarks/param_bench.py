@@ -0,0 +1,75 @@
+# -*- coding: utf-8 -*-
+
+"""
+Compares the time for parameter-heavy circuits (a hardware-efficient ansatz as
+used by VQE, with a literal angle for every rotation) with gate parameters and
+matrices evaluated in the precision of the complex table and in double
+precision (--parameter_precision double). The ansatz is run once as is and
+once with every gate conditioned on a classical register that stays zero,
+such that only parsing and compilation remain.
+
+usage: python3 param_bench.py [path to jku_simulator] [number of layers] ...
+"""
+
+import os
+import random
+import resource
+import subprocess
+import sys
+import tempfile
+
+
+def ansatz(n, layers, compile_only):
+    # ry, rz and cz as in qelib1.inc, such that no include is required; the entangling layer
+    # is applied twice and cancels
+    random.seed(1)
+    cond = 'if(c==1) ' if compile_only else ''
+    lines = ['OPENQASM 2.0;',
+             'gate u3(theta,phi,lambda) q { U(theta,phi,lambda) q; }',
+             'gate ry(theta) a { u3(theta,0,0) a; }',
+             'gate rz(phi) a { u3(0,0,phi) a; }',
+             'gate h a { u3(pi/2,0,pi) a; }',
+             'gate cx c,t { CX c,t; }',
+             'gate cz a,b { h b; cx a,b; h b; }',
+             'qreg q[%d];' % n, 'creg c[%d];' % n]
+    for _ in range(layers):
+        for i in range(n):
+            lines.append(cond + 'ry(%.17g) q[%d];' % (random.uniform(-3.2, 3.2), i))
+            lines.append(cond + 'rz(-pi/2%+.17g) q[%d];' % (random.uniform(-3.2, 3.2), i))
+        for _ in range(2):
+            for i in range(n - 1):
+                lines.append(cond + 'cz q[%d],q[%d];' % (i, i + 1))
+    lines.append('measure q -> c;')
+    return lines
+
+
+def run(simulator, fname, options):
+    # user time of the simulator process (parsing, compilation and simulation)
+    before = resource.getrusage(resource.RUSAGE_CHILDREN).ru_utime
+    subprocess.run([simulator, '--simulate_qasm', fname, '--shots', '1', '--seed', '1'] + options,
+                   stdout=subprocess.DEVNULL, check=True)
+    return resource.getrusage(resource.RUSAGE_CHILDREN).ru_utime - before
+
+
+def main():
+    simulator = os.path.abspath(sys.argv[1] if len(sys.argv) > 1 else 'jku_simulator')
+    sizes = [int(n) for n in sys.argv[2:]] or [100, 400, 1600]
+    n = 8
+
+    print('%-8s %6s %10s %12s %12s %8s' % ('run', 'layers', 'rotations', 'mpfr', 'double',
+                                           'speedup'))
+    with tempfile.TemporaryDirectory() as tmp:
+        for compile_only in [False, True]:
+            for layers in sizes:
+                fname = os.path.join(tmp, 'ansatz%d.qasm' % layers)
+                with open(fname, 'w') as f:
+                    f.write('\n'.join(ansatz(n, layers, compile_only)) + '\n')
+                precise = run(simulator, fname, [])
+                double = run(simulator, fname, ['--parameter_precision', 'double'])
+                print('%-8s %6d %10d %11.3fs %11.3fs %7.1fx' % ('compile' if compile_only else 'full',
+                                                            layers, 2 * n * layers, precise, double,
+                                                            precise / max(double, 1e-9)))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,77 @@
+# -*- coding: utf-8 -*-
+
+"""
+Compares the simulation time of the quantum Fourier transform with diagonal
+gates (u1, cu1, cz) applied by scaling the edges of the state decision diagram
+and with all gates applied by multiplication (--generic_gates), once for a
+basis state and once for a dense input state.
+
+usage: python3 qft_bench.py [path to jku_simulator] [number of qubits] ...
+"""
+
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+
+def qft(n, dense):
+    # h and cu1 as in qelib1.inc, such that no include is required
+    lines = ['OPENQASM 2.0;',
+             'gate h a { U(pi/2,0,pi) a; }',
+             'gate u1(lambda) a { U(0,0,lambda) a; }',
+             'gate cx c,t { CX c,t; }',
+             'gate cu1(lambda) a,b { u1(lambda/2) a; cx a,b; u1(-lambda/2) b; cx a,b; u1(lambda/2) b; }',
+             'gate cz a,b { h b; cx a,b; h b; }',
+             'qreg q[%d];' % n, 'creg c[%d];' % n]
+    if dense:
+        # GHZ state with a phase on every qubit: the decision diagram becomes exponential
+        lines.append('h q[0];')
+        for i in range(n - 1):
+            lines.append('cx q[%d],q[%d];' % (i, i + 1))
+        for i in range(n):
+            lines.append('u1(%f) q[%d];' % (0.1 * (i + 1), i))
+            lines.append('cz q[%d],q[%d];' % (i, (i + 1) % n))
+    else:
+        # basis state (as in phase estimation): the decision diagram stays linear
+        for i in range(0, n, 3):
+            lines.append('U(pi,0,pi) q[%d];' % i)
+    for i in range(n):
+        lines.append('h q[%d];' % i)
+        for j in range(i + 1, n):
+            lines.append('cu1(pi/%d) q[%d],q[%d];' % (2 ** (j - i), j, i))
+    return lines
+
+
+def run(simulator, fname, options):
+    out = subprocess.run([simulator, '--simulate_qasm', fname, '--shots', '1',
+                          '--seed', '1', '--ps'] + options,
+                         stdout=subprocess.PIPE, universal_newlines=True).stdout
+    nodes = int(re.search(r'Maximal size of DD.*: (\d+)', out).group(1))
+    seconds = float(re.search(r'Simulation time: ([0-9.e+-]+)', out).group(1))
+    return nodes, seconds
+
+
+def main():
+    simulator = os.path.abspath(sys.argv[1] if len(sys.argv) > 1 else 'jku_simulator')
+    sizes = [int(n) for n in sys.argv[2:]] or [16, 24, 32, 40]
+
+    print('%-6s %6s %10s %12s %12s %8s' % ('input', 'qubits', 'max. nodes', 'diagonal',
+                                           'generic', 'speedup'))
+    with tempfile.TemporaryDirectory() as tmp:
+        # dense inputs only for the smallest sizes, their decision diagrams have 2^n nodes
+        for dense, ns in [(False, sizes), (True, [n for n in sizes if n <= 14] or [12, 14])]:
+            for n in ns:
+                fname = os.path.join(tmp, 'qft%d.qasm' % n)
+                with open(fname, 'w') as f:
+                    f.write('\n'.join(qft(n, dense)) + '\n')
+                diagonal = run(simulator, fname, [])
+                generic = run(simulator, fname, ['--generic_gates'])
+                print('%-6s %6d %10d %11.3fs %11.3fs %7.1fx' % ('dense' if dense else 'basis', n,
+                                                            diagonal[0], diagonal[1], generic[1],
+                                                            generic[1] / max(diagonal[1], 1e-9)))
+
+
+if __name__ == '__main__':
+    main()
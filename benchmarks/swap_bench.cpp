@@ -0,0 +1,124 @@
+/*
+DD-based simulator by JKU Linz, Austria
+
+Developer: Alwin Zulehner, Robert Wille
+
+With code from the QMDD implementation provided by Michael Miller (University of Victoria, Canada)
+and Philipp Niemann (University of Bremen, Germany).
+
+For more information, please visit http://iic.jku.at/eda/research/quantum_simulation
+
+If you have any questions feel free to contact us using
+alwin.zulehner@jku.at or robert.wille@jku.at
+
+If you use the quantum simulator for your research, we would be thankful if you referred to it
+by citing the following publication:
+
+@article{zulehner2018simulation,
+    title={Advanced Simulation of Quantum Computations},
+    author={Zulehner, Alwin and Wille, Robert},
+    journal={IEEE Transactions on Computer Aided Design of Integrated Circuits and Systems (TCAD)},
+    year={2018},
+    eprint = {arXiv:1707.00865}
+}
+*/
+
+/*
+ * Micro benchmark for adjacent variable swaps (QMDDswap).
+ *
+ * Builds vectors with 0/1 entries (so that swapping never requires
+ * renormalization) from a growing number of random minterms and measures the
+ * number of swaps per second of two adjacent levels for different numbers of
+ * nodes on these levels. After the swaps, all minterms are checked.
+ * QMDDswap is only used by the legacy sifting (QMDDsift, SJTalgorithm); the
+ * dynamic reordering of the simulator is based on QMDDexchange.
+ *
+ * usage: swap_bench [number of variables (24)] [number of swaps per population (200)]
+ */
+
+#include <QMDDcore.h>
+#include <QMDDpackage.h>
+#include <QMDDreorder.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <set>
+#include <vector>
+
+// vector with ones at the given minterms (bit v of a minterm is the value of variable v),
+// built level by level so that the cost is linear in the number of minterms
+static QMDDedge mintermVector(std::vector<unsigned long long>::iterator first,
+		std::vector<unsigned long long>::iterator last, int level) {
+	if (first == last) {
+		return QMDDzero;
+	}
+	if (level < 0) {
+		return QMDDone;
+	}
+	int v = QMDDorder[level];
+	auto mid = std::partition(first, last, [v](unsigned long long m) { return ((m >> v) & 1) == 0; });
+	QMDDedge edges[MAXNEDGE];
+	edges[0] = mintermVector(first, mid, level - 1);
+	edges[1] = QMDDzero;
+	edges[2] = mintermVector(mid, last, level - 1);
+	edges[3] = QMDDzero;
+	return QMDDmakeNonterminal(v, edges);
+}
+
+// entry of the vector e for the given minterm (follows the current variable order)
+static uint64_t entry(QMDDedge e, unsigned long long minterm) {
+	uint64_t w = e.w;
+	while (!QMDDterminal(e)) {
+		e = e.p->e[((minterm >> e.p->v) & 1) * Radix];
+		w = Cmul(w, e.w);
+	}
+	return w;
+}
+
+int main(int argc, char** argv) {
+	int n = argc > 1 ? atoi(argv[1]) : 24;
+	int swaps = argc > 2 ? atoi(argv[2]) : 200;
+
+	QMDDinit(0);
+	std::mt19937_64 gen(42);
+
+	std::cout << "minterms  nodes(i)  nodes(i-1)      swaps/s" << std::endl;
+
+	for (int logm = 4; logm <= 16 && logm < n; logm += 2) {
+		std::set<unsigned long long> unique;
+		while (unique.size() < (1u << logm)) {
+			unique.insert(gen() & ((1ull << n) - 1));
+		}
+		std::vector<unsigned long long> minterms(unique.begin(), unique.end());
+		QMDDedge f = mintermVector(minterms.begin(), minterms.end(), n - 1);
+		QMDDincref(f);
+
+		// level i has at most 2^(n-1-i) nodes, so both levels hold about as many nodes as minterms
+		int i = n - 1 - logm;
+		int upper = Active[QMDDorder[i]], lower = Active[QMDDorder[i - 1]];
+
+		auto t1 = std::chrono::high_resolution_clock::now();
+		for (int s = 0; s < swaps; s++) {
+			QMDDswap(i);
+		}
+		auto t2 = std::chrono::high_resolution_clock::now();
+		double seconds = std::chrono::duration<double>(t2 - t1).count();
+
+		for (auto it = minterms.begin(); it != minterms.end(); it++) {
+			if (entry(f, *it) != COMPLEX_ONE) {
+				std::cerr << "wrong entry after swapping" << std::endl;
+				return 1;
+			}
+		}
+
+		printf("%8d  %8d  %10d  %11.0f\n", 1 << logm, upper, lower, swaps / seconds);
+		fflush(stdout);
+
+		QMDDdecref(f);
+		QMDDgarbageCollect();
+	}
+	return 0;
+}
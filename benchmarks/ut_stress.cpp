@@ -0,0 +1,199 @@
+/*
+DD-based simulator by JKU Linz, Austria
+
+Developer: Alwin Zulehner, Robert Wille
+
+With code from the QMDD implementation provided by Michael Miller (University of Victoria, Canada)
+and Philipp Niemann (University of Bremen, Germany).
+
+For more information, please visit http://iic.jku.at/eda/research/quantum_simulation
+
+If you have any questions feel free to contact us using
+alwin.zulehner@jku.at or robert.wille@jku.at
+
+If you use the quantum simulator for your research, we would be thankful if you referred to it
+by citing the following publication:
+
+@article{zulehner2018simulation,
+    title={Advanced Simulation of Quantum Computations},
+    author={Zulehner, Alwin and Wille, Robert},
+    journal={IEEE Transactions on Computer Aided Design of Integrated Circuits and Systems (TCAD)},
+    year={2018},
+    eprint = {arXiv:1707.00865}
+}
+*/
+
+/*
+ * Stress benchmark for the unique table.
+ *
+ * Measures the throughput of QMDDutLookup for inserting new nodes and for
+ * looking up existing nodes with 1..N threads and compares it with a plain
+ * single-threaded chained table (the unique table before it became concurrent).
+ *
+ * usage: ut_stress [number of nodes] [max. number of threads]
+ */
+
+#include <QMDDcore.h>
+#include <QMDDpackage.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#define LEVELS 16
+
+// fills a node with a unique pattern for the given key (no complex arithmetic
+// is required for the lookup, the weights are compared bitwise only)
+static void makeNode(QMDDnodeptr p, unsigned int key) {
+	p->v = key % LEVELS;
+	p->renormFactor = COMPLEX_ONE;
+	p->computeSpecialMatricesFlag = 1;
+	p->e[0] = QMDDone;
+	p->e[1] = QMDDzero;
+	p->e[2].p = QMDDtnode;
+	p->e[2].w = ((uint64_t) (key / LEVELS + 2)) << 32;
+	p->e[3] = QMDDzero;
+}
+
+static void clearTable() {
+	for (int v = 0; v < LEVELS; v++) {
+		for (int j = 0; j < NBUCKET; j++) {
+			Unique[v][j] = NULL;
+		}
+		UniqueNodes[v] = NULL;
+	}
+	QMDDnodecount = 0;
+}
+
+static void worker(const std::vector<unsigned int>* keys, size_t from, size_t step, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		QMDDedge e;
+		e.p = QMDDgetNode();
+		e.w = COMPLEX_ONE;
+		makeNode(e.p, (*keys)[(from + i * step) % keys->size()]);
+		QMDDutLookup(e);
+	}
+}
+
+// runs the given number of threads on the keys
+// partition: thread t handles the keys t, t+threads, ... (i.e. every key once)
+// otherwise: every thread handles all keys (starting at a different position)
+static double run(int threads, const std::vector<unsigned int>& keys, bool partition) {
+	std::vector<std::thread> pool;
+	size_t n = keys.size();
+	QMDDconcurrent = threads > 1;
+	auto t1 = std::chrono::high_resolution_clock::now();
+	for (int t = threads - 1; t >= 0; t--) {
+		size_t from = partition ? t : t * n / threads;
+		size_t step = partition ? threads : 1;
+		size_t count = partition ? (n - t + threads - 1) / threads : n;
+		if (t == 0) {
+			worker(&keys, from, step, count);
+		} else {
+			pool.push_back(std::thread(worker, &keys, from, step, count));
+		}
+	}
+	for (std::thread& t : pool) {
+		t.join();
+	}
+	auto t2 = std::chrono::high_resolution_clock::now();
+	QMDDconcurrent = false;
+	return std::chrono::duration<double>(t2 - t1).count();
+}
+
+/*
+ * reference: plain single-threaded chained table with the same hash function
+ */
+static QMDDnodeptr legacyUnique[LEVELS][NBUCKET];
+static QMDDnodeptr legacyAvail = NULL;
+
+static QMDDnodeptr legacyGetNode() {
+	if (legacyAvail != NULL) {
+		QMDDnodeptr r = legacyAvail;
+		legacyAvail = r->next;
+		return r;
+	}
+	return (QMDDnodeptr) malloc(sizeof(QMDDnode));
+}
+
+static void legacyLookup(QMDDnodeptr q) {
+	intptr_t key = 0;
+	for (int i = 0; i < Nedge; i++)
+		key += ((intptr_t) (q->e[i].p) >> i) + (q->e[i].w >> 32) + q->e[i].w;
+	key = key & HASHMASK;
+
+	QMDDnodeptr p = legacyUnique[q->v][key];
+	while (p != NULL) {
+		if (memcmp(q->e, p->e, Nedge * sizeof(QMDDedge)) == 0) {
+			q->next = legacyAvail;
+			legacyAvail = q;
+			return;
+		}
+		p = p->next;
+	}
+	q->next = legacyUnique[q->v][key];
+	legacyUnique[q->v][key] = q;
+}
+
+static double runLegacy(const std::vector<unsigned int>& keys) {
+	auto t1 = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < keys.size(); i++) {
+		QMDDnodeptr p = legacyGetNode();
+		makeNode(p, keys[i]);
+		legacyLookup(p);
+	}
+	auto t2 = std::chrono::high_resolution_clock::now();
+	return std::chrono::duration<double>(t2 - t1).count();
+}
+
+static void report(const char* table, int threads, const char* phase, size_t ops, double seconds) {
+	std::cout << table << "\t" << threads << "\t" << phase << "\t" << ops << "\t" << seconds << "\t"
+			<< (ops / seconds / 1e6) << std::endl;
+}
+
+int main(int argc, char** argv) {
+	size_t nodes = argc > 1 ? strtoul(argv[1], NULL, 10) : (1u << 20);
+	int max_threads = argc > 2 ? atoi(argv[2]) : (int) std::thread::hardware_concurrency();
+	if (max_threads < 1) {
+		max_threads = 1;
+	}
+
+	QMDDinit(0);
+
+	std::vector<unsigned int> keys(nodes);
+	for (size_t i = 0; i < nodes; i++) {
+		keys[i] = (unsigned int) i;
+	}
+	std::mt19937 gen(42);
+	std::shuffle(keys.begin(), keys.end(), gen);
+
+	std::cout << "table\tthreads\tphase\tops\tseconds\tMops/s" << std::endl;
+
+	report("legacy", 1, "insert", nodes, runLegacy(keys));
+	report("legacy", 1, "lookup", nodes, runLegacy(keys));
+
+	for (int threads = 1; threads <= max_threads; threads *= 2) {
+		clearTable();
+
+		// every node is inserted exactly once
+		double t = run(threads, keys, true);
+		report("unique", threads, "insert", nodes, t);
+		if ((size_t) QMDDnodecount != nodes) {
+			std::cerr << "ERROR: expected " << nodes << " nodes in the unique table, found " << QMDDnodecount << std::endl;
+			return 1;
+		}
+
+		// every thread looks up all nodes
+		t = run(threads, keys, false);
+		report("unique", threads, "lookup", nodes * threads, t);
+		if ((size_t) QMDDnodecount != nodes) {
+			std::cerr << "ERROR: duplicate nodes in the unique table (" << QMDDnodecount << " instead of " << nodes << ")" << std::endl;
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -69,6 +69,7 @@ class JKUSimulatorWrapper:
         self.shots = 1
         self.exec = exe
         self.additional_output_data = []
+        self.options = []  # further command line options of the JKU exe
         self.silent = silent
 
     def set_config(self, global_config, experiment_config):
@@ -90,6 +91,9 @@ class JKUSimulatorWrapper:
                ]
         if 'probabilities' in self.additional_output_data:
             cmd.append('--display_probabilities')
+        if 'statevector_ket' in self.additional_output_data:
+            cmd.append('--sparse_statevector')
+        cmd.extend(self.options)
         if not self.silent:
             print(RUN_MESSAGE)
         output = subprocess.check_output(cmd, input=qasm, stderr=subprocess.STDOUT,
@@ -196,6 +200,9 @@ class JKUSimulatorWrapper:
             if 'probabilities' in self.additional_output_data:
                 snapshot_data['probabilities'] = self.convert_probabilities(probs_data,
                                                                             translation_table)
+        if 'statevector_ket' in snapshot_data:
+            snapshot_data['statevector_ket'] = self.convert_statevector_ket(
+                snapshot_data['statevector_ket'])
         if 'probabilities_ket' in snapshot_data:
             probs_ket_data = snapshot_data.pop('probabilities_ket')
             if 'probabilities_ket' in self.additional_output_data:
@@ -210,6 +217,10 @@ class JKUSimulatorWrapper:
         return [self.to_qiskit_complex(statevector[translation_table[i]])
                 for i in range(len(translation_table))]
 
+    def convert_statevector_ket(self, statevector_ket):
+        return dict([(key[::-1], self.to_qiskit_complex(value))
+                     for key, value in statevector_ket.items()])
+
     def convert_probabilities(self, probs_data, translation_table):
         return [probs_data[translation_table[i]] for i in range(len(translation_table))]
 
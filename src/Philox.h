@@ -0,0 +1,108 @@
+/*
+DD-based simulator by JKU Linz, Austria
+
+Developer: Alwin Zulehner, Robert Wille
+
+With code from the QMDD implementation provided by Michael Miller (University of Victoria, Canada)
+and Philipp Niemann (University of Bremen, Germany).
+
+For more information, please visit http://iic.jku.at/eda/research/quantum_simulation
+
+If you have any questions feel free to contact us using
+alwin.zulehner@jku.at or robert.wille@jku.at
+
+If you use the quantum simulator for your research, we would be thankful if you referred to it
+by citing the following publication:
+
+@article{zulehner2018simulation,
+    title={Advanced Simulation of Quantum Computations},
+    author={Zulehner, Alwin and Wille, Robert},
+    journal={IEEE Transactions on Computer Aided Design of Integrated Circuits and Systems (TCAD)},
+    year={2018},
+    eprint = {arXiv:1707.00865}
+}
+*/
+
+#ifndef PHILOX_H_
+#define PHILOX_H_
+
+#include <stdint.h>
+
+/*****************************************************************
+
+    Philox4x32-10 counter-based random number generator
+    (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3", SC 2011)
+
+    Every (key, counter) pair is mapped to four independent 32-bit
+    values, i.e. any number of streams can be drawn from in any order
+    and on any thread without sharing state.
+
+*****************************************************************/
+
+class Philox4x32 {
+public:
+	explicit Philox4x32(uint64_t seed) {
+		key[0] = (uint32_t) seed;
+		key[1] = (uint32_t) (seed >> 32);
+	}
+
+	// returns the four 32-bit values for the counter (stream, index)
+	void Generate(uint64_t stream, uint64_t index, uint32_t out[4]) const {
+		uint32_t c[4] = {(uint32_t) index, (uint32_t) (index >> 32), (uint32_t) stream, (uint32_t) (stream >> 32)};
+		uint32_t k[2] = {key[0], key[1]};
+		for(int r = 0; r < 10; r++) {
+			if(r > 0) {
+				k[0] += 0x9E3779B9u;
+				k[1] += 0xBB67AE85u;
+			}
+			uint64_t p0 = (uint64_t) 0xD2511F53u * c[0];
+			uint64_t p1 = (uint64_t) 0xCD9E8D57u * c[2];
+			uint32_t t[4] = {(uint32_t) (p1 >> 32) ^ c[1] ^ k[0], (uint32_t) p1, (uint32_t) (p0 >> 32) ^ c[3] ^ k[1], (uint32_t) p0};
+			c[0] = t[0];
+			c[1] = t[1];
+			c[2] = t[2];
+			c[3] = t[3];
+		}
+		out[0] = c[0];
+		out[1] = c[1];
+		out[2] = c[2];
+		out[3] = c[3];
+	}
+
+	// converts two 32-bit values to a double in [0, 1) with 53 random bits
+	static double ToDouble(uint32_t hi, uint32_t lo) {
+		return (double) ((((uint64_t) hi << 32) | lo) >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+private:
+	uint32_t key[2];
+};
+
+// uniform random bit generator (e.g. for std::binomial_distribution) drawing the
+// values of one stream of a Philox4x32 in order, starting at counter (stream, 0)
+class PhiloxStream {
+public:
+	typedef uint32_t result_type;
+
+	PhiloxStream(const Philox4x32& rng, uint64_t stream) : rng(rng), stream(stream) {}
+
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return 0xFFFFFFFFu; }
+
+	result_type operator()() {
+		if(pos == 4) {
+			rng.Generate(stream, index++, buf);
+			pos = 0;
+		}
+		return buf[pos++];
+	}
+
+private:
+	const Philox4x32& rng;
+	uint64_t stream;
+	uint64_t index = 0;
+	uint32_t buf[4];
+	int pos = 4;
+};
+
+#endif /* PHILOX_H_ */
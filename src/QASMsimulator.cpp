@@ -47,12 +47,6 @@ QASMsimulator::~QASMsimulator() {
 	delete scanner;
 	delete in;
 
-	for(auto it = compoundGates.begin(); it != compoundGates.end(); it++) {
-		for(auto it2 = it->second.gates.begin(); it2 != it->second.gates.end(); it2++) {
-			delete *it2;
-		}
-	}
-
 	for(auto it = snapshots.begin(); it != snapshots.end(); it++) {
 		delete it->second;
 	}
@@ -101,7 +95,7 @@ std::pair<std::string, int> QASMsimulator::QASMargumentCreg() {
 		scan();
 		check(Token::Kind::nninteger);
 		index = t.val;
-		if(index < 0 || index >= cregs[s].first) {
+		if(index < 0 || index >= cregs[s].second) {
 			std::cerr << "Index of creg " << s << " is out of bounds: " << index << std::endl;
 		}
 		check(Token::Kind::rbrack);
@@ -111,161 +105,96 @@ std::pair<std::string, int> QASMsimulator::QASMargumentCreg() {
 }
 
 
-QASMsimulator::Expr* QASMsimulator::QASMexponentiation() {
-	Expr* x;
-
+void QASMsimulator::QASMexponentiation(ParamExpr& expr) {
 	if(sym == Token::Kind::real) {
 		scan();
-		return new Expr(Expr::Kind::number, NULL, NULL, t.valReal, "");
-		//return mpreal(t.val_real);
+		PushOp(expr, ParamExpr::Op::number, AddConstant(t.valReal));
 	} else if(sym == Token::Kind::nninteger) {
 		scan();
-		return new Expr(Expr::Kind::number, NULL, NULL, t.val, "");
-		//return mpreal(t.val);
+		PushOp(expr, ParamExpr::Op::number, AddConstant(t.val));
 	} else if(sym == Token::Kind::pi) {
 		scan();
-		return new Expr(Expr::Kind::number, NULL, NULL, mpfr::const_pi(), "");
-		//return mpfr::const_pi();
+		int index = AddConstant(M_PI);
+		if(!double_parameters) {
+			constants[index] = mpfr::const_pi();
+		}
+		PushOp(expr, ParamExpr::Op::number, index);
 	} else if(sym == Token::Kind::identifier) {
 		scan();
-		return new Expr(Expr::Kind::id, NULL, NULL, 0, t.str);
-		//return it->second;
+		if(parameter_names == NULL) {
+			std::cerr << "Undefined parameter: " << t.str << std::endl;
+			exit(1);
+		}
+		auto it = std::find(parameter_names->begin(), parameter_names->end(), t.str);
+		if(it == parameter_names->end()) {
+			std::cerr << "Undefined parameter: " << t.str << std::endl;
+			exit(1);
+		}
+		PushOp(expr, ParamExpr::Op::param, it - parameter_names->begin());
 	} else if(sym == Token::Kind::lpar) {
 		scan();
-		x = QASMexp();
+		QASMexp(expr);
 		check(Token::Kind::rpar);
-		return x;
 	} else if(unaryops.find(sym) != unaryops.end()) {
-		Token::Kind op = sym;
+		static const std::map<Token::Kind, ParamExpr::Op> ops {
+			{Token::Kind::sin, ParamExpr::Op::sin}, {Token::Kind::cos, ParamExpr::Op::cos},
+			{Token::Kind::tan, ParamExpr::Op::tan}, {Token::Kind::exp, ParamExpr::Op::exp},
+			{Token::Kind::ln, ParamExpr::Op::ln}, {Token::Kind::sqrt, ParamExpr::Op::sqrt}};
+		ParamExpr::Op op = ops.at(sym);
 		scan();
 		check(Token::Kind::lpar);
-		x = QASMexp();
+		QASMexp(expr);
 		check(Token::Kind::rpar);
-		if(x->kind == Expr::Kind::number) {
-			if(op == Token::Kind::sin) {
-				x->num = sin(x->num);
-			} else if(op == Token::Kind::cos) {
-				x->num = cos(x->num);
-			} else if(op == Token::Kind::tan) {
-				x->num = tan(x->num);
-			} else if(op == Token::Kind::exp) {
-				x->num = exp(x->num);
-			} else if(op == Token::Kind::ln) {
-				x->num = log(x->num);
-			} else if(op == Token::Kind::sqrt) {
-				x->num = sqrt(x->num);
-			}
-			return x;
-		} else {
-			if(op == Token::Kind::sin) {
-				return new Expr(Expr::Kind::sin, x, NULL, 0, "");
-			} else if(op == Token::Kind::cos) {
-				return new Expr(Expr::Kind::cos, x, NULL, 0, "");
-			} else if(op == Token::Kind::tan) {
-				return new Expr(Expr::Kind::tan, x, NULL, 0, "");
-			} else if(op == Token::Kind::exp) {
-				return new Expr(Expr::Kind::exp, x, NULL, 0, "");
-			} else if(op == Token::Kind::ln) {
-				return new Expr(Expr::Kind::ln, x, NULL, 0, "");
-			} else if(op == Token::Kind::sqrt) {
-				return new Expr(Expr::Kind::sqrt, x, NULL, 0, "");
-			}
-		}
+		PushOp(expr, op, 0);
 	} else {
 		std::cerr << "Invalid Expression" << std::endl;
+		exit(1);
 	}
-	return NULL;
 }
 
-QASMsimulator::Expr* QASMsimulator::QASMfactor() {
-	Expr* x;
-	Expr* y;
-	x = QASMexponentiation();
+void QASMsimulator::QASMfactor(ParamExpr& expr) {
+	QASMexponentiation(expr);
 	while (sym == Token::Kind::power) {
 		scan();
-		y = QASMexponentiation();
-		if(x->kind == Expr::Kind::number && y->kind == Expr::Kind::number) {
-			x->num = pow(x->num, y->num);
-			delete y;
-		} else {
-			x = new Expr(Expr::Kind::power, x, y, 0, "");
-		}
+		QASMexponentiation(expr);
+		PushOp(expr, ParamExpr::Op::power, 0);
 	}
-
-	return x;
 }
 
-QASMsimulator::Expr* QASMsimulator::QASMterm() {
-	QASMsimulator::Expr* x = QASMfactor();
-	QASMsimulator::Expr* y;
-
+void QASMsimulator::QASMterm(ParamExpr& expr) {
+	QASMfactor(expr);
 	while(sym == Token::Kind::times || sym == Token::Kind::div) {
 		Token::Kind op = sym;
 		scan();
-		y = QASMfactor();
-		if(op == Token::Kind::times) {
-			if(x->kind == Expr::Kind::number && y->kind == Expr::Kind::number) {
-				x->num = x->num * y->num;
-				delete y;
-			} else {
-				x = new Expr(Expr::Kind::times, x, y, 0, "");
-			}
-		} else {
-			if(x->kind == Expr::Kind::number && y->kind == Expr::Kind::number) {
-				x->num = x->num / y->num;
-				delete y;
-			} else {
-				x = new Expr(Expr::Kind::div, x, y, 0, "");
-			}
-		}
+		QASMfactor(expr);
+		PushOp(expr, op == Token::Kind::times ? ParamExpr::Op::times : ParamExpr::Op::div, 0);
 	}
-	return x;
 }
 
-QASMsimulator::Expr* QASMsimulator::QASMexp() {
-	Expr* x;
-	Expr* y;
+void QASMsimulator::QASMexp(ParamExpr& expr) {
 	if(sym == Token::Kind::minus) {
 		scan();
-		x = QASMterm();
-		if(x->kind == Expr::Kind::number) {
-			x->num = -x->num;
-		} else {
-			x = new Expr(Expr::Kind::sign, x, NULL, 0, "");
-		}
+		QASMterm(expr);
+		PushOp(expr, ParamExpr::Op::sign, 0);
 	} else {
-		x = QASMterm();
+		QASMterm(expr);
 	}
 
 	while(sym == Token::Kind::plus || sym == Token::Kind::minus) {
 		Token::Kind op = sym;
 		scan();
-		y = QASMterm();
-		if(op == Token::Kind::plus) {
-			if(x->kind == Expr::Kind::number && y->kind == Expr::Kind::number) {
-				x->num = x->num + y->num;
-				delete y;
-			} else {
-				x = new Expr(Expr::Kind::plus, x, y, 0, "");
-			}
-		} else {
-			if(x->kind == Expr::Kind::number && y->kind == Expr::Kind::number) {
-				x->num = x->num - y->num;
-				delete y;
-			} else {
-				x = new Expr(Expr::Kind::minus, x, y, 0, "");
-			}
-		}
+		QASMterm(expr);
+		PushOp(expr, op == Token::Kind::plus ? ParamExpr::Op::plus : ParamExpr::Op::minus, 0);
 	}
-	return x;
 }
 
-void QASMsimulator::QASMexpList(std::vector<Expr*>& expressions) {
-	Expr* x = QASMexp();
-	expressions.push_back(x);
+void QASMsimulator::QASMexpList(std::vector<ParamExpr>& expressions) {
+	expressions.emplace_back();
+	QASMexp(expressions.back());
 	while(sym == Token::Kind::comma) {
 		scan();
-		expressions.push_back(QASMexp());
+		expressions.emplace_back();
+		QASMexp(expressions.back());
 	}
 }
 
@@ -277,40 +206,39 @@ void QASMsimulator::QASMargsList(std::vector<std::pair<int, int> >& arguments) {
 	}
 }
 
-void QASMsimulator::QASMgate(bool execute) {
+void QASMsimulator::QASMgate() {
 	if(sym == Token::Kind::ugate) {
 		scan();
+		// outside of gate declarations, expressions are folded to a single constant, which is only
+		// needed until the gate is compiled
+		unsigned int n = constants_double.size();
+		ParamExpr theta, phi, lambda;
 		check(Token::Kind::lpar);
-		Expr* theta = QASMexp();
+		QASMexp(theta);
 		check(Token::Kind::comma);
-		Expr* phi = QASMexp();
+		QASMexp(phi);
 		check(Token::Kind::comma);
-		Expr* lambda = QASMexp();
+		QASMexp(lambda);
 		check(Token::Kind::rpar);
 		std::pair<int, int> target = QASMargumentQreg();
 		check(Token::Kind::semicolon);
 
-		if(execute) {
-			for(int i = 0; i < target.second; i++) {
-				tmp_matrix[0][0] = Cmake(cos(-(phi->num+lambda->num)/2)*cos(theta->num/2), sin(-(phi->num+lambda->num)/2)*cos(theta->num/2));
-				tmp_matrix[0][1] = Cmake(-cos(-(phi->num-lambda->num)/2)*sin(theta->num/2), -sin(-(phi->num-lambda->num)/2)*sin(theta->num/2));
-				tmp_matrix[1][0] = Cmake(cos((phi->num-lambda->num)/2)*sin(theta->num/2), sin((phi->num-lambda->num)/2)*sin(theta->num/2));
-				tmp_matrix[1][1] = Cmake(cos((phi->num+lambda->num)/2)*cos(theta->num/2), sin((phi->num+lambda->num)/2)*cos(theta->num/2));
-
-				line[nqubits-1-(target.first+i)] = 2;
-
-				QMDDedge f = QMDDmvlgate(tmp_matrix, nqubits, line);
-				line[nqubits-1-(target.first+i)] = -1;
-
-				ApplyGate(f);
+		gate_arguments.push_back(std::vector<std::pair<int, int> >(1, target));
+		int th = theta.code[0].second, ph = phi.code[0].second, lam = lambda.code[0].second;
+		for(int i = 0; i < target.second; i++) {
+			if(double_parameters) {
+				EmitU(constants_double[th], constants_double[ph], constants_double[lam], target.first+i);
+			} else {
+				EmitU(constants[th], constants[ph], constants[lam], target.first+i);
 			}
 		}
-		delete theta;
-		delete phi;
-		delete lambda;
+		constants_double.resize(n);
+		if(!double_parameters) {
+			constants.resize(n);
+		}
 
 #if VERBOSE
-		std::cout << "Applied gate: U" << std::endl;
+		std::cout << "Compiled gate: U" << std::endl;
 #endif
 
 	} else if(sym == Token::Kind::cxgate) {
@@ -320,48 +248,33 @@ void QASMsimulator::QASMgate(bool execute) {
 		std::pair<int, int> target = QASMargumentQreg();
 		check(Token::Kind::semicolon);
 
-		if(execute) {
-			if(control.second == target.second) {
-				for(int i = 0; i < target.second; i++) {
-					line[nqubits-1-(control.first+i)] = 1;
-					line[nqubits-1-(target.first+i)] = 2;
-					QMDDedge f = QMDDmvlgate(Nm, nqubits, line);
-					line[nqubits-1-(control.first+i)] = -1;
-					line[nqubits-1-(target.first+i)] = -1;
-					ApplyGate(f);
-				}
-			} else if(control.second == 1) {
-				for(int i = 0; i < target.second; i++) {
-					line[nqubits-1-control.first] = 1;
-					line[nqubits-1-(target.first+i)] = 2;
-					QMDDedge f = QMDDmvlgate(Nm, nqubits, line);
-					line[nqubits-1-control.first] = -1;
-					line[nqubits-1-(target.first+i)] = -1;
-					ApplyGate(f);
-				}
-			} else if(target.second == 1) {
-				for(int i = 0; i < target.second; i++) {
-					line[nqubits-1-(control.first+i)] = 1;
-					line[nqubits-1-target.first] = 2;
-					QMDDedge f = QMDDmvlgate(Nm, nqubits, line);
-					line[nqubits-1-(control.first+i)] = -1;
-					line[nqubits-1-target.first] = -1;
-					ApplyGate(f);
-				}
-			} else {
-				std::cerr << "Register size does not match for CX gate!" << std::endl;
+		gate_arguments.push_back({control, target});
+		if(control.second == target.second) {
+			for(int i = 0; i < target.second; i++) {
+				EmitCX(control.first+i, target.first+i);
 			}
+		} else if(control.second == 1) {
+			for(int i = 0; i < target.second; i++) {
+				EmitCX(control.first, target.first+i);
+			}
+		} else if(target.second == 1) {
+			for(int i = 0; i < target.second; i++) {
+				EmitCX(control.first+i, target.first);
+			}
+		} else {
+			std::cerr << "Register size does not match for CX gate!" << std::endl;
+		}
 #if VERBOSE
-		std::cout << "Applied gate: CX" << std::endl;
+		std::cout << "Compiled gate: CX" << std::endl;
 #endif
-		}
 	} else if(sym == Token::Kind::identifier) {
 		scan();
 		auto gateIt = compoundGates.find(t.str);
 		if(gateIt != compoundGates.end()) {
 			std::string gate_name = t.str;
 
-			std::vector<Expr*> parameters;
+			unsigned int n = constants_double.size();
+			std::vector<ParamExpr> parameters;
 			std::vector<std::pair<int, int> > arguments;
 			if(sym == Token::Kind::lpar) {
 				scan();
@@ -373,102 +286,541 @@ void QASMsimulator::QASMgate(bool execute) {
 			QASMargsList(arguments);
 			check(Token::Kind::semicolon);
 
-			if(execute) {
-				std::map<std::string, std::pair<int, int> > argsMap;
-				std::map<std::string, Expr*> paramsMap;
-				int size = 1;
-				int i = 0;
-				for(auto it = arguments.begin(); it != arguments.end(); it++) {
-					argsMap[gateIt->second.argumentNames[i]] = *it;
-					i++;
-					if(it->second > 1 && size != 1 && it->second != size) {
-						std::cerr << "Register sizes do not match!" << std::endl;
-					}
-					if(it->second > 1) {
-						size = it->second;
+			gate_arguments.push_back(arguments);
+			CompoundGate& g = gateIt->second;
+			if(parameters.size() != g.parameterNames.size() || arguments.size() != g.argumentNames.size()) {
+				std::cerr << "Wrong number of parameters or arguments for gate " << gate_name << "!" << std::endl;
+				exit(1);
+			}
+			int size = 1;
+			for(auto it = arguments.begin(); it != arguments.end(); it++) {
+				if(it->second > 1 && size != 1 && it->second != size) {
+					std::cerr << "Register sizes do not match!" << std::endl;
+				}
+				if(it->second > 1) {
+					size = it->second;
+				}
+			}
+			std::vector<double> params;
+			std::vector<mpreal> precise_params;
+			for(auto it = parameters.begin(); it != parameters.end(); it++) {
+				params.push_back(constants_double[it->code[0].second]);
+				if(!double_parameters) {
+					precise_params.push_back(constants[it->code[0].second]);
+				}
+			}
+			constants_double.resize(n);
+			if(!double_parameters) {
+				constants.resize(n);
+			}
+
+			// swap gates only change which variables represent the qubits, (controlled) X gates
+			// rearrange the edges of the state and diagonal gates scale its edges; if a qubit is combined with every qubit of a register,
+			// this is left to the gates, which are broadcast one after the other
+			bool emitted = false;
+			if(g.swap && !generic_gates && DisjointArguments(arguments)) {
+				// in the order of the CX gates, which are applied if the variables cannot be exchanged
+				int a = g.ops[0].args[0];
+				for(int i = 0; i < size; i++) {
+					Instruction swap(Instruction::Kind::swap);
+					swap.qubits = {arguments[a].first + i, arguments[1 - a].first + i};
+					Emit(swap);
+				}
+				emitted = true;
+			}
+			if(!emitted && !generic_gates && (!g.xline.empty() || g.diagonal) && DisjointArguments(arguments)) {
+				std::vector<int> slots;
+				for(unsigned int j = 0; j < arguments.size(); j++) {
+					slots.push_back(j);
+				}
+				if(!g.xline.empty() || !g.diag.empty()) {
+					EmitSpecialGate(arguments, g.xline, g.xphase, g.diag, g.ops, 0, g.ops.size(), slots, precise_params);
+					emitted = true;
+				} else if(g.ops.size() > 1) {
+					std::vector<std::complex<double> > diag;
+					if(EvaluateDiagonal(g.ops, 0, g.ops.size(), slots, params, diag)) {
+						EmitSpecialGate(arguments, g.xline, g.xphase, diag, g.ops, 0, g.ops.size(), slots, precise_params);
+						emitted = true;
 					}
 				}
-				for(unsigned int i = 0; i < parameters.size(); i++) {
-					paramsMap[gateIt->second.parameterNames[i]] = parameters[i];
+			}
+
+			if(!emitted) {
+				EmitGates(g.ops, 0, g.ops.size(), arguments, params, precise_params);
+			}
+
+#if VERBOSE
+		std::cout << "Compiled gate: " << gate_name << std::endl;
+#endif
+		} else {
+			std::cerr << "Undefined gate: " << t.str << std::endl;
+		}
+	}
+}
+
+void QASMsimulator::EmitGates(std::vector<GateOp>& ops, unsigned int begin, unsigned int end, std::vector<std::pair<int, int> >& arguments, std::vector<double>& params, std::vector<mpreal>& precise_params) {
+	// compiles the operations begin, ..., end - 1 of the body of a compound gate for the given arguments
+	// (qubit or register per argument of the gate) and values of its parameters (precise_params only
+	// unless double_parameters is set), every operation is broadcast over the registers of its arguments
+	for(unsigned int k = begin; k < end; k++) {
+		GateOp& op = ops[k];
+		if(op.kind == GateOp::Kind::U) {
+			std::pair<int, int>& target = arguments[op.args[0]];
+			if(double_parameters) {
+				double theta = EvaluateParams(op.theta, params, constants_double, stack_double);
+				double phi = EvaluateParams(op.phi, params, constants_double, stack_double);
+				double lambda = EvaluateParams(op.lambda, params, constants_double, stack_double);
+				for(int i = 0; i < target.second; i++) {
+					EmitU(theta, phi, lambda, target.first+i);
+				}
+			} else {
+				mpreal theta = EvaluateParams(op.theta, precise_params, constants, stack);
+				mpreal phi = EvaluateParams(op.phi, precise_params, constants, stack);
+				mpreal lambda = EvaluateParams(op.lambda, precise_params, constants, stack);
+				for(int i = 0; i < target.second; i++) {
+					EmitU(theta, phi, lambda, target.first+i);
+				}
+			}
+		} else if(op.kind == GateOp::Kind::CX) {
+			std::pair<int, int>& control = arguments[op.args[0]];
+			std::pair<int, int>& target = arguments[op.args[1]];
+			if(control.second == target.second) {
+				for(int i = 0; i < target.second; i++) {
+					EmitCX(control.first+i, target.first+i);
+				}
+			} else if(control.second == 1) {
+				for(int i = 0; i < target.second; i++) {
+					EmitCX(control.first, target.first+i);
+				}
+			} else if(target.second == 1) {
+				for(int i = 0; i < target.second; i++) {
+					EmitCX(control.first+i, target.first);
 				}
+			} else {
+				std::cerr << "Register size does not match for CX gate!" << std::endl;
+			}
+		} else {
+			// otherwise, the body following the call is compiled
+			std::vector<std::pair<int, int> > args;
+			for(auto it = op.args.begin(); it != op.args.end(); it++) {
+				args.push_back(arguments[*it]);
+			}
+			std::vector<std::complex<double> > diag;
+			if(DisjointArguments(args) && (!op.xline.empty() || !op.diag.empty())) {
+				EmitSpecialGate(args, op.xline, op.phase, op.diag, ops, k + 1, k + 1 + op.length, op.args, precise_params);
+				k += op.length;
+			} else if(DisjointArguments(args) && EvaluateDiagonal(ops, k + 1, k + 1 + op.length, op.args, params, diag)) {
+				EmitSpecialGate(args, op.xline, op.phase, diag, ops, k + 1, k + 1 + op.length, op.args, precise_params);
+				k += op.length;
+			}
+		}
+	}
+}
 
-				for(auto it = gateIt->second.gates.begin(); it != gateIt->second.gates.end(); it++) {
-					if(Ugate* u = dynamic_cast<Ugate*>(*it)) {
-						Expr* theta = RewriteExpr(u->theta, paramsMap);
-						Expr* phi = RewriteExpr(u->phi, paramsMap);
-						Expr* lambda = RewriteExpr(u->lambda, paramsMap);
+void QASMsimulator::EmitSpecialGate(std::vector<std::pair<int, int> >& arguments, std::vector<int>& xline, std::complex<double> phase, std::vector<std::complex<double> >& diag, std::vector<GateOp>& ops, unsigned int begin, unsigned int end, std::vector<int>& slots, std::vector<mpreal>& precise_params) {
+	// compiles the (controlled) X given by xline (line[] per argument) and phase or, if xline is empty,
+	// the diagonal gate diag for every index of the arguments, which have to be disjoint (DisjointArguments)
+	// unless double_parameters is set, phase and diag only identify the entries, which are evaluated again
+	// from the operations begin, ..., end - 1 (on the arguments slots of the body) in the precision of the
+	// complex table
+	std::vector<uint64_t> d;
+	uint64_t w = COMPLEX_ONE;
+	if(double_parameters) {
+		w = CmakeDouble(phase.real(), phase.imag());
+		for(auto it = diag.begin(); it != diag.end(); it++) {
+			d.push_back(CmakeDouble(it->real(), it->imag()));
+		}
+	} else {
+		std::vector<mpreal> re, im;
+		if(xline.empty()) {
+			for(unsigned int x = 0; x < diag.size(); x++) {
+				EvaluateColumn(ops, begin, end, slots, precise_params, x, re, im);
+				d.push_back(Cmake(re[x], im[x]));
+			}
+		} else {
+			// the phase is the only nonzero entry of any column
+			EvaluateColumn(ops, begin, end, slots, precise_params, 0, re, im);
+			unsigned int y = 0;
+			for(unsigned int r = 1; r < re.size(); r++) {
+				if(re[r] * re[r] + im[r] * im[r] > re[y] * re[y] + im[y] * im[y]) {
+					y = r;
+				}
+			}
+			w = Cmake(re[y], im[y]);
+		}
+	}
+	RetainWeight(w);
+	for(auto it = d.begin(); it != d.end(); it++) {
+		RetainWeight(*it);
+	}
+	for(int i = 0; i < arguments[0].second; i++) {
+		Instruction instruction(xline.empty() ? Instruction::Kind::diagonal : Instruction::Kind::permutation);
+		for(unsigned int j = 0; j < arguments.size(); j++) {
+			instruction.qubits.push_back(arguments[j].first + i);
+		}
+		if(xline.empty()) {
+			instruction.weights = d;
+		} else {
+			instruction.values = xline;
+			instruction.weights.push_back(w);
+		}
+		Emit(instruction);
+	}
+}
 
-						for(int i = 0; i < argsMap[u->target].second; i++) {
-							tmp_matrix[0][0] = Cmake(cos(-(phi->num+lambda->num)/2)*cos(theta->num/2), sin(-(phi->num+lambda->num)/2)*cos(theta->num/2));
-							tmp_matrix[0][1] = Cmake(-cos(-(phi->num-lambda->num)/2)*sin(theta->num/2), -sin(-(phi->num-lambda->num)/2)*sin(theta->num/2));
-							tmp_matrix[1][0] = Cmake(cos((phi->num-lambda->num)/2)*sin(theta->num/2), sin((phi->num-lambda->num)/2)*sin(theta->num/2));
-							tmp_matrix[1][1] = Cmake(cos((phi->num+lambda->num)/2)*cos(theta->num/2), sin((phi->num+lambda->num)/2)*cos(theta->num/2));
+bool QASMsimulator::DisjointArguments(std::vector<std::pair<int, int> >& arguments) {
+	// true if all arguments are single qubits or registers of the same size and no two are the same,
+	// such that applying the gate per index is the same as broadcasting its gates one after the other
+	for(unsigned int j = 0; j < arguments.size(); j++) {
+		for(unsigned int k = 0; k < j; k++) {
+			if(arguments[j].second != arguments[k].second || arguments[j].first == arguments[k].first) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
 
-							line[nqubits-1-(argsMap[u->target].first+i)] = 2;
-							QMDDedge f = QMDDmvlgate(tmp_matrix, nqubits, line);
-							line[nqubits-1-(argsMap[u->target].first+i)] = -1;
+void QASMsimulator::EmitU(mpreal theta, mpreal phi, mpreal lambda, int target) {
+	uint64_t m[2][2];
+	m[0][0] = Cmake(cos(-(phi+lambda)/2)*cos(theta/2), sin(-(phi+lambda)/2)*cos(theta/2));
+	m[0][1] = Cmake(-cos(-(phi-lambda)/2)*sin(theta/2), -sin(-(phi-lambda)/2)*sin(theta/2));
+	m[1][0] = Cmake(cos((phi-lambda)/2)*sin(theta/2), sin((phi-lambda)/2)*sin(theta/2));
+	m[1][1] = Cmake(cos((phi+lambda)/2)*cos(theta/2), sin((phi+lambda)/2)*cos(theta/2));
+	EmitMatrix(m, target);
+}
 
-							ApplyGate(f);
-						}
-						delete theta;
-						delete phi;
-						delete lambda;
-					} else if(CXgate* cx = dynamic_cast<CXgate*>(*it)) {
-						if(argsMap[cx->control].second == argsMap[cx->target].second) {
-							for(int i = 0; i < argsMap[cx->target].second; i++) {
-								line[nqubits-1-(argsMap[cx->control].first+i)] = 1;
-								line[nqubits-1-(argsMap[cx->target].first+i)] = 2;
-								QMDDedge f = QMDDmvlgate(Nm, nqubits, line);
-								line[nqubits-1-(argsMap[cx->control].first+i)] = -1;
-								line[nqubits-1-(argsMap[cx->target].first+i)] = -1;
-								ApplyGate(f);
-							}
-						} else if(argsMap[cx->control].second == 1) {
-							for(int i = 0; i < argsMap[cx->target].second; i++) {
-								line[nqubits-1-argsMap[cx->control].first] = 1;
-								line[nqubits-1-(argsMap[cx->target].first+i)] = 2;
-								QMDDedge f = QMDDmvlgate(Nm, nqubits, line);
-								line[nqubits-1-argsMap[cx->control].first] = -1;
-								line[nqubits-1-(argsMap[cx->target].first+i)] = -1;
-								ApplyGate(f);
-							}
-						} else if(argsMap[cx->target].second == 1) {
-							for(int i = 0; i < argsMap[cx->target].second; i++) {
-								line[nqubits-1-(argsMap[cx->control].first+i)] = 1;
-								line[nqubits-1-argsMap[cx->target].first] = 2;
-								QMDDedge f = QMDDmvlgate(Nm, nqubits, line);
-								line[nqubits-1-(argsMap[cx->control].first+i)] = -1;
-								line[nqubits-1-argsMap[cx->target].first] = -1;
-								ApplyGate(f);
-							}
-						} else {
-							std::cerr << "Register size does not match for CX gate!" << std::endl;
-						}
+void QASMsimulator::EmitU(double theta, double phi, double lambda, int target) {
+	// as above, but the entries are computed in double precision
+	uint64_t m[2][2];
+	m[0][0] = CmakeDouble(std::cos(-(phi+lambda)/2)*std::cos(theta/2), std::sin(-(phi+lambda)/2)*std::cos(theta/2));
+	m[0][1] = CmakeDouble(-std::cos(-(phi-lambda)/2)*std::sin(theta/2), -std::sin(-(phi-lambda)/2)*std::sin(theta/2));
+	m[1][0] = CmakeDouble(std::cos((phi-lambda)/2)*std::sin(theta/2), std::sin((phi-lambda)/2)*std::sin(theta/2));
+	m[1][1] = CmakeDouble(std::cos((phi+lambda)/2)*std::cos(theta/2), std::sin((phi+lambda)/2)*std::cos(theta/2));
+	EmitMatrix(m, target);
+}
+
+void QASMsimulator::EmitMatrix(uint64_t m[2][2], int target) {
+	// compiles the single-qubit gate with the matrix m as a diagonal gate, an X up to a global phase or U
+	Instruction instruction(Instruction::Kind::U);
+	instruction.qubits.push_back(target);
+	if(!generic_gates && m[0][1] == COMPLEX_ZERO && m[1][0] == COMPLEX_ZERO) {
+		// diagonal (e.g., u1, rz, t, s)
+		instruction.kind = Instruction::Kind::diagonal;
+		instruction.weights = {m[0][0], m[1][1]};
+	} else if(!generic_gates && m[0][0] == COMPLEX_ZERO && m[1][1] == COMPLEX_ZERO && m[0][1] == m[1][0]) {
+		// X up to a global phase
+		instruction.kind = Instruction::Kind::permutation;
+		instruction.values.push_back(Radix);
+		instruction.weights.push_back(m[1][0]);
+	} else {
+		instruction.weights = {m[0][0], m[0][1], m[1][0], m[1][1]};
+	}
+	for(auto it = instruction.weights.begin(); it != instruction.weights.end(); it++) {
+		RetainWeight(*it);
+	}
+	Emit(instruction);
+}
+
+void QASMsimulator::EmitCX(int control, int target) {
+	Instruction instruction(Instruction::Kind::CX);
+	instruction.qubits = {control, target};
+	Emit(instruction);
+}
+
+void QASMsimulator::ApplyCX(int control, int target) {
+	line[qubit_var[control]] = 1;
+	line[qubit_var[target]] = 2;
+	if(!generic_gates) {
+		ApplyPermutation(COMPLEX_ONE);
+		line[qubit_var[control]] = -1;
+		line[qubit_var[target]] = -1;
+	} else {
+		QMDDedge f = QMDDmvlgate(Nm, nqubits, line);
+		line[qubit_var[control]] = -1;
+		line[qubit_var[target]] = -1;
+		ApplyGate(f);
+	}
+}
+
+bool QASMsimulator::EvaluateGates(std::vector<GateOp>& ops, unsigned int begin, unsigned int end, std::vector<int>& bit, std::vector<double>& params, std::vector<std::complex<double> >& m) {
+	// multiplies m (row-major, bit bit[a] of an index is the value of argument a) from the left by the
+	// unitary of the operations begin, ..., end - 1 in double precision; false if an operation acts on
+	// other arguments (bit[a] < 0)
+	unsigned int dim = 1u << std::count_if(bit.begin(), bit.end(), [](int b) { return b >= 0; });
+	for(unsigned int k = begin; k < end; k++) {
+		GateOp& op = ops[k];
+		for(auto it = op.args.begin(); it != op.args.end(); it++) {
+			if(*it >= (int)bit.size() || bit[*it] < 0) {
+				return false;
+			}
+		}
+		if(op.kind == GateOp::Kind::U) {
+			double th = EvaluateParams(op.theta, params, constants_double, stack_double);
+			double ph = EvaluateParams(op.phi, params, constants_double, stack_double);
+			double lam = EvaluateParams(op.lambda, params, constants_double, stack_double);
+			std::complex<double> u00 = std::polar(cos(th/2), -(ph+lam)/2), u01 = -std::polar(sin(th/2), -(ph-lam)/2);
+			std::complex<double> u10 = std::polar(sin(th/2), (ph-lam)/2), u11 = std::polar(cos(th/2), (ph+lam)/2);
+			unsigned int target = 1u << bit[op.args[0]];
+			for(unsigned int r = 0; r < dim; r++) {
+				if(r & target) {
+					continue;
+				}
+				for(unsigned int x = 0; x < dim; x++) {
+					std::complex<double> a = m[r * dim + x], b = m[(r | target) * dim + x];
+					m[r * dim + x] = u00 * a + u01 * b;
+					m[(r | target) * dim + x] = u10 * a + u11 * b;
+				}
+			}
+		} else if(op.kind == GateOp::Kind::CX) {
+			unsigned int c = 1u << bit[op.args[0]], target = 1u << bit[op.args[1]];
+			for(unsigned int r = 0; r < dim; r++) {
+				if((r & c) && !(r & target)) {
+					for(unsigned int x = 0; x < dim; x++) {
+						std::swap(m[r * dim + x], m[(r | target) * dim + x]);
 					}
 				}
-
-#if VERBOSE
-		std::cout << "Applied gate: " << gate_name << std::endl;
-#endif
 			}
 		} else {
-			std::cerr << "Undefined gate: " << t.str << std::endl;
+			if(op.xline.empty() && op.diag.empty()) {
+				// diagonal depending on parameters, evaluated by its body
+				continue;
+			}
+			unsigned int target = 0, used = 0;
+			std::vector<std::pair<unsigned int, int> > controls;
+			for(unsigned int j = 0; j < op.args.size(); j++) {
+				unsigned int b = 1u << bit[op.args[j]];
+				if(used & b) {
+					return false;
+				}
+				used |= b;
+				if(!op.diag.empty()) {
+					continue;
+				}
+				if(op.xline[j] == Radix) {
+					target = b;
+				} else if(op.xline[j] >= 0) {
+					controls.push_back(std::make_pair(b, op.xline[j]));
+				}
+			}
+			k += op.length;
+			if(!op.diag.empty()) {
+				// scale every row by the entry for the values of the arguments
+				for(unsigned int r = 0; r < dim; r++) {
+					unsigned int x = 0;
+					for(unsigned int j = 0; j < op.args.size(); j++) {
+						x |= ((r >> bit[op.args[j]]) & 1) << j;
+					}
+					for(unsigned int c = 0; c < dim; c++) {
+						m[r * dim + c] *= op.diag[x];
+					}
+				}
+				continue;
+			}
+			// swap the rows in which the controls are satisfied, then apply the phase
+			for(unsigned int r = 0; r < dim; r++) {
+				bool satisfied = !(r & target);
+				for(auto c = controls.begin(); c != controls.end(); c++) {
+					satisfied = satisfied && ((r & c->first) != 0) == (c->second == 1);
+				}
+				if(satisfied) {
+					for(unsigned int x = 0; x < dim; x++) {
+						std::swap(m[r * dim + x], m[(r | target) * dim + x]);
+					}
+				}
+			}
+			for(unsigned int i = 0; i < dim * dim; i++) {
+				m[i] *= op.phase;
+			}
 		}
 	}
+	return true;
 }
 
-void QASMsimulator::Reset() {
-	Simulator::Reset();
-	qregs.clear();
+bool QASMsimulator::EvaluateDiagonal(std::vector<GateOp>& ops, unsigned int begin, unsigned int end, std::vector<int>& arguments, std::vector<double>& params, std::vector<std::complex<double> >& diag) {
+	// sets diag to the diagonal of the unitary of the operations begin, ..., end - 1 on the (distinct)
+	// arguments; false if it is not diagonal or cannot be evaluated
+	std::vector<int> bit(*std::max_element(arguments.begin(), arguments.end()) + 1, -1);
+	for(unsigned int j = 0; j < arguments.size(); j++) {
+		if(bit[arguments[j]] >= 0) {
+			return false;
+		}
+		bit[arguments[j]] = j;
+	}
+	unsigned int dim = 1u << arguments.size();
+	std::vector<std::complex<double> > m(dim * dim, 0);
+	for(unsigned int x = 0; x < dim; x++) {
+		m[x * dim + x] = 1;
+	}
+	return EvaluateGates(ops, begin, end, bit, params, m) && Diagonal(m, diag);
+}
 
-	for(auto it = cregs.begin(); it != cregs.end(); it++) {
-		delete it->second.second;
+bool QASMsimulator::Diagonal(std::vector<std::complex<double> >& m, std::vector<std::complex<double> >& diag) {
+	// sets diag to the diagonal of the square matrix m if all other entries vanish
+	unsigned int dim = sqrt(m.size());
+	double tol = Ctol.toDouble();
+	for(unsigned int x = 0; x < dim; x++) {
+		for(unsigned int r = 0; r < dim; r++) {
+			if(r != x && std::abs(m[r * dim + x]) > tol) {
+				return false;
+			}
+		}
 	}
-	cregs.clear();
-	delete scanner;
-	in->clear();
-	in->seekg(0, in->beg);
-	this->scanner = new QASMscanner(*this->in);
+	diag.clear();
+	for(unsigned int x = 0; x < dim; x++) {
+		diag.push_back(m[x * dim + x]);
+	}
+	return true;
+}
+
+void QASMsimulator::EvaluateColumn(std::vector<GateOp>& ops, unsigned int begin, unsigned int end, std::vector<int>& arguments, std::vector<mpreal>& params, unsigned int col, std::vector<mpreal>& re, std::vector<mpreal>& im) {
+	// sets re and im to column col of the unitary of the operations begin, ..., end - 1 on the (distinct)
+	// arguments in the precision of the complex table; calls of special gates are evaluated by their
+	// bodies (which follow them) instead of their matrices in double precision
+	std::vector<int> bit(*std::max_element(arguments.begin(), arguments.end()) + 1, -1);
+	for(unsigned int j = 0; j < arguments.size(); j++) {
+		bit[arguments[j]] = j;
+	}
+	unsigned int dim = 1u << arguments.size();
+	re.assign(dim, mpreal(0));
+	im.assign(dim, mpreal(0));
+	re[col] = 1;
+
+	for(unsigned int k = begin; k < end; k++) {
+		GateOp& op = ops[k];
+		if(op.kind == GateOp::Kind::U) {
+			mpreal th = EvaluateParams(op.theta, params, constants, stack);
+			mpreal ph = EvaluateParams(op.phi, params, constants, stack);
+			mpreal lam = EvaluateParams(op.lambda, params, constants, stack);
+			mpreal u[4][2] = {{cos(-(ph+lam)/2)*cos(th/2), sin(-(ph+lam)/2)*cos(th/2)},
+					{-cos(-(ph-lam)/2)*sin(th/2), -sin(-(ph-lam)/2)*sin(th/2)},
+					{cos((ph-lam)/2)*sin(th/2), sin((ph-lam)/2)*sin(th/2)},
+					{cos((ph+lam)/2)*cos(th/2), sin((ph+lam)/2)*cos(th/2)}};
+			unsigned int target = 1u << bit[op.args[0]];
+			for(unsigned int r = 0; r < dim; r++) {
+				if(r & target) {
+					continue;
+				}
+				mpreal are = re[r], aim = im[r], bre = re[r | target], bim = im[r | target];
+				re[r] = u[0][0] * are - u[0][1] * aim + u[1][0] * bre - u[1][1] * bim;
+				im[r] = u[0][0] * aim + u[0][1] * are + u[1][0] * bim + u[1][1] * bre;
+				re[r | target] = u[2][0] * are - u[2][1] * aim + u[3][0] * bre - u[3][1] * bim;
+				im[r | target] = u[2][0] * aim + u[2][1] * are + u[3][0] * bim + u[3][1] * bre;
+			}
+		} else if(op.kind == GateOp::Kind::CX) {
+			unsigned int c = 1u << bit[op.args[0]], target = 1u << bit[op.args[1]];
+			for(unsigned int r = 0; r < dim; r++) {
+				if((r & c) && !(r & target)) {
+					std::swap(re[r], re[r | target]);
+					std::swap(im[r], im[r | target]);
+				}
+			}
+		}
+	}
+}
+
+void QASMsimulator::CheckSpecialGate(CompoundGate& gate) {
+	// evaluates the body of a gate on all basis states of its (at most four) arguments and sets diag
+	// if it is diagonal (e.g., cz) or xline and xphase if it is an X gate with positive and negative
+	// controls (e.g., ccx) up to a global phase; gates with parameters are evaluated for arbitrary
+	// values and only marked as diagonal (e.g., cu1), their diagonal is evaluated whenever they are
+	// applied
+	unsigned int k = gate.argumentNames.size();
+	std::set<std::string> distinct(gate.argumentNames.begin(), gate.argumentNames.end());
+	if(k == 0 || k > 4 || distinct.size() != k || gate.ops.empty()) {
+		return;
+	}
+	std::vector<int> bit;
+	for(unsigned int j = 0; j < k; j++) {
+		bit.push_back(j);
+	}
+	std::vector<double> params;
+	for(unsigned int i = 0; i < gate.parameterNames.size(); i++) {
+		params.push_back(0.3 + 0.7 * (i + 1));
+	}
+
+	// m[row * dim + col] is the unitary of the body (bit j of an index is the value of argument j)
+	unsigned int dim = 1u << k;
+	std::vector<std::complex<double> > m(dim * dim, 0);
+	for(unsigned int x = 0; x < dim; x++) {
+		m[x * dim + x] = 1;
+	}
+	if(!EvaluateGates(gate.ops, 0, gate.ops.size(), bit, params, m)) {
+		return;
+	}
+
+	double tol = Ctol.toDouble();
+	if(Diagonal(m, gate.diag)) {
+		gate.diagonal = true;
+		if(!gate.parameterNames.empty()) {
+			gate.diag.clear();
+		}
+		return;
+	}
+	if(!gate.parameterNames.empty()) {
+		return;
+	}
+
+	// every column has to contain a single entry (the same phase everywhere) and the nonzero
+	// entries off the diagonal have to flip the same argument
+	std::complex<double> phase = 0;
+	int target = -1;
+	std::vector<unsigned int> flipped;
+	for(unsigned int x = 0; x < dim; x++) {
+		int y = -1;
+		for(unsigned int r = 0; r < dim; r++) {
+			if(std::abs(m[r * dim + x]) > tol) {
+				if(y >= 0) {
+					return;
+				}
+				y = r;
+			}
+		}
+		if(y < 0 || (x > 0 && std::abs(m[y * dim + x] - phase) > tol)) {
+			return;
+		}
+		phase = m[y * dim + x];
+		unsigned int d = x ^ y;
+		if(d != 0) {
+			if((d & (d - 1)) != 0 || (target >= 0 && d != 1u << target)) {
+				return;
+			}
+			for(target = 0; d != 1u << target; target++);
+			flipped.push_back(x);
+		}
+	}
+	if(target < 0 || std::abs(std::abs(phase) - 1) > tol) {
+		return;
+	}
+
+	// the flipped basis states have to be exactly those in which the controls are satisfied
+	std::vector<int> xline(k, -1);
+	unsigned int controls = 0;
+	xline[target] = Radix;
+	for(unsigned int j = 0; j < k; j++) {
+		if((int)j == target) {
+			continue;
+		}
+		unsigned int ones = 0;
+		for(auto it = flipped.begin(); it != flipped.end(); it++) {
+			ones += (*it >> j) & 1;
+		}
+		if(ones == 0 || ones == flipped.size()) {
+			xline[j] = ones == 0 ? 0 : 1;
+			controls++;
+		}
+	}
+	if(flipped.size() != dim >> controls) {
+		return;
+	}
+	gate.xline = xline;
+	gate.xphase = phase;
+}
+
+void QASMsimulator::Reset() {
+	Simulator::Reset();
+	std::fill(cbits.begin(), cbits.end(), 0);
+	branched = false;
 
 	for(auto it = snapshots.begin(); it != snapshots.end(); it++) {
 		delete it->second;
@@ -483,41 +835,37 @@ void QASMsimulator::Simulate(int shots) {
 
 	std::map<std::string, int> result;
 
-	Simulate();
+	Compile();
+	if(interaction_order) {
+		InteractionOrder();
+	}
+
 	if(!intermediate_measurement) {
+		Simulate();
+		min_fidelity = GetFidelity();
 		ResetBeforeMeasurement();
-		for(int i = 0; i < shots; i++) {
-			MeasureAll(false);
-			std::stringstream s;
-			for(int i=circ.n-1;i >=0; i--) {
-				s << measurements[i];
-			}
-			if(result.find(s.str()) != result.end()) {
-				result[s.str()]++;
-			} else {
-				result[s.str()] = 1;
-			}
-		}
+		SampleAll(shots, result);
 	} else {
-		MeasureAll(false);
-		std::stringstream s;
-		for(int i=circ.n-1;i >=0; i--) {
-			s << measurements[i];
+		// split the shots at the measurements such that every distinct sequence of outcomes
+		// is simulated only once
+		branching = true;
+		branch_shots = shots;
+		branch_counts = &result;
+		min_fidelity = 1.0;
+		Simulate();
+		if(!branched) {
+			FinishBranch();
 		}
-		result[s.str()] = 1;
-		for(int i = 1; i < shots; i++) {
-			Reset();
-			Simulate();
-			MeasureAll(false);
-			std::stringstream s;
-			for(int j=circ.n-1;j >=0; j--) {
-				s << measurements[j];
-			}
-			if(result.find(s.str()) != result.end()) {
-				result[s.str()]++;
-			} else {
-				result[s.str()] = 1;
-			}
+		branching = false;
+	}
+
+	std::ofstream binary_out;
+	unsigned long long binary_offset = 0;
+	if(!binary_statevector.empty() && display_statevector) {
+		binary_out.open(binary_statevector, std::ios::out | std::ios::binary | std::ios::trunc);
+		if(!binary_out) {
+			std::cerr << "Failed to open file '" << binary_statevector << "'!" << std::endl;
+			exit(1);
 		}
 	}
 
@@ -529,12 +877,25 @@ void QASMsimulator::Simulate(int shots) {
 	}
 	std::cout << "  }";
 
+	if(IsApproximating()) {
+		std::cout << "," << std::endl << "  \"fidelity\": " << min_fidelity;
+	}
+
 	if(snapshots.size() > 0) {
 		std::cout << "," << std::endl;
 		std::cout << "  \"snapshots\": {" << std::endl;
 		for(auto it = snapshots.begin(); it != snapshots.end(); it++) {
 			std::cout << "    \"" << it->first << "\": {" << std::endl;
-			if(display_probabilities) {
+			bool separator = false;
+			if(!it->second->expectation_values.empty()) {
+				std::cout << "      \"expectation_values\": [" << it->second->expectation_values[0];
+				for(unsigned int i = 1; i < it->second->expectation_values.size(); i++) {
+					std::cout << ", " << it->second->expectation_values[i];
+				}
+				std::cout << "]," << std::endl;
+				std::cout << "      \"expectation_value\": " << it->second->expectation_value;
+				separator = true;
+			} else if(display_probabilities) {
 				std::cout << "      \"probabilities\": [" << it->second->probabilities[0];
 				for(unsigned long long i = 1; i < it->second->len; i++) {
 					std::cout << ", " << it->second->probabilities[i];
@@ -548,16 +909,55 @@ void QASMsimulator::Simulate(int shots) {
 					std::cout << ", \"" << it2->first << "\": " << it2->second;
 				}
 				std::cout << "}";
+				separator = true;
 			}
 			if(display_statevector && it->second->statevector != NULL) {
-				if(display_probabilities) {
+				if(separator) {
 					std::cout << "," << std::endl;
 				}
-				std::cout << "      \"statevector\": [\"" << it->second->statevector[0];
-				for(unsigned long long i = 1; i < it->second->len; i++) {
-					std::cout << "\", \"" << it->second->statevector[i];
+				if(binary_statevector.empty()) {
+					std::cout << "      \"statevector\": [\"";
+					PrintAmplitude(it->second->statevector[0], std::cout);
+					for(unsigned long long i = 1; i < it->second->len; i++) {
+						std::cout << "\", \"";
+						PrintAmplitude(it->second->statevector[i], std::cout);
+					}
+					std::cout << "\"]";
+				} else {
+					// raw complex128 values (little-endian on all supported platforms)
+					binary_out.write(reinterpret_cast<char*>(it->second->statevector), it->second->len * sizeof(std::complex<double>));
+					std::cout << "      \"statevector_binary\": {\"file\": \"" << binary_statevector << "\", \"offset\": " << binary_offset << ", \"length\": " << it->second->len << "}";
+					binary_offset += it->second->len * sizeof(std::complex<double>);
 				}
-				std::cout << "\"]";
+				separator = true;
+			}
+			if(it->second->sparse) {
+				if(separator) {
+					std::cout << "," << std::endl;
+				}
+				std::cout << "      \"statevector_ket\": {";
+				for(auto it2 = it->second->statevector_ket.begin(); it2 != it->second->statevector_ket.end(); it2++) {
+					std::cout << (it2 != it->second->statevector_ket.begin() ? ", " : "") << "\"" << it2->first << "\": \"";
+					PrintAmplitude(it2->second, std::cout);
+					std::cout << "\"";
+				}
+				std::cout << "}";
+				separator = true;
+			}
+			if(display_overlaps && !it->second->overlaps.empty()) {
+				if(separator) {
+					std::cout << "," << std::endl;
+				}
+				std::cout << "      \"overlaps\": {";
+				for(auto it2 = it->second->overlaps.begin(); it2 != it->second->overlaps.end(); it2++) {
+					std::cout << (it2 != it->second->overlaps.begin() ? ", " : "") << "\"" << it2->first << "\": \"" << it2->second << "\"";
+				}
+				std::cout << "}," << std::endl;
+				std::cout << "      \"fidelities\": {";
+				for(auto it2 = it->second->fidelities.begin(); it2 != it->second->fidelities.end(); it2++) {
+					std::cout << (it2 != it->second->fidelities.begin() ? ", " : "") << "\"" << it2->first << "\": " << it2->second;
+				}
+				std::cout << "}";
 			}
 			std::cout << std::endl << "    }" << (std::next(it,1) != snapshots.end() ? "," : "") << std::endl;
 		}
@@ -566,6 +966,52 @@ void QASMsimulator::Simulate(int shots) {
 	std::cout << "}" << std::endl;
 }
 
+void QASMsimulator::PrintAmplitude(std::complex<double> c, std::ostream& os) {
+	// same format as Cprint
+	if(c.real() == 0 && c.imag() == 0) {
+		os << "0";
+		return;
+	}
+	if(c.real() != 0) {
+		os << c.real();
+	}
+	if(c.imag() != 0) {
+		os << (c.imag() < 0 ? "-" : "+") << std::abs(c.imag()) << "i";
+	}
+}
+
+void QASMsimulator::QASMpauliTerms(std::string str, std::vector<std::pair<double, std::string> >& terms) {
+	// parses a weighted sum of Pauli strings, e.g. "0.5 ZZ, -0.2 XY, IZ"
+	std::stringstream ss(str);
+	std::string term;
+	while(std::getline(ss, term, ',')) {
+		std::stringstream ts(term);
+		std::vector<std::string> tokens;
+		std::string token;
+		while(ts >> token) {
+			tokens.push_back(token);
+		}
+		if(tokens.empty()) {
+			continue;
+		}
+
+		double coeff = 1.0;
+		std::string pauli = tokens.back();
+		if(tokens.size() == 2) {
+			char* end;
+			coeff = strtod(tokens[0].c_str(), &end);
+			if(*end != '\0') {
+				tokens.push_back("");
+			}
+		}
+		if(tokens.size() > 2 || pauli.find_first_not_of("IXYZ") != std::string::npos) {
+			std::cerr << "ERROR in snapshot: invalid Pauli term \"" << term << "\"" << std::endl;
+			exit(1);
+		}
+		terms.push_back(std::make_pair(coeff, pauli));
+	}
+}
+
 void QASMsimulator::QASMidList(std::vector<std::string>& identifiers) {
 	check(Token::Kind::identifier);
 	identifiers.push_back(t.str);
@@ -576,85 +1022,136 @@ void QASMsimulator::QASMidList(std::vector<std::string>& identifiers) {
 	}
 }
 
-QASMsimulator::Expr* QASMsimulator::RewriteExpr(Expr* expr, std::map<std::string, Expr*>& exprMap) {
-	if(expr == NULL) {
-		return NULL;
+int QASMsimulator::AddConstant(double value) {
+	// adds a constant for parameter expressions and returns its index, every constant is referred
+	// to by a single expression (such that it can be folded in place)
+	constants_double.push_back(value);
+	if(!double_parameters) {
+		constants.push_back(value);
 	}
-	Expr* op1 = RewriteExpr(expr->op1, exprMap);
-	Expr* op2 = RewriteExpr(expr->op2, exprMap);
+	return constants_double.size() - 1;
+}
 
-	if(expr->kind == Expr::Kind::number) {
-		return new Expr(expr->kind, op1, op2, expr->num, expr->id);
-	} else if(expr->kind == Expr::Kind::plus) {
-		if(op1->kind == Expr::Kind::number && op2->kind == Expr::Kind::number) {
-			op1->num = op1->num + op2->num;
-			delete op2;
-			return op1;
-		}
-	} else if(expr->kind == Expr::Kind::minus) {
-		if(op1->kind == Expr::Kind::number && op2->kind == Expr::Kind::number) {
-			op1->num = op1->num - op2->num;
-			delete op2;
-			return op1;
-		}
-	} else if(expr->kind == Expr::Kind::sign) {
-		if(op1->kind == Expr::Kind::number) {
-			op1->num = -op1->num;
-			return op1;
-		}
-	} else if(expr->kind == Expr::Kind::times) {
-		if(op1->kind == Expr::Kind::number && op2->kind == Expr::Kind::number) {
-			op1->num = op1->num * op2->num;
-			delete op2;
-			return op1;
-		}
-	} else if(expr->kind == Expr::Kind::div) {
-		if(op1->kind == Expr::Kind::number && op2->kind == Expr::Kind::number) {
-			op1->num = op1->num / op2->num;
-			delete op2;
-			return op1;
-		}
-	} else if(expr->kind == Expr::Kind::power) {
-		if(op1->kind == Expr::Kind::number && op2->kind == Expr::Kind::number) {
-			op1->num = pow(op1->num,op2->num);
-			delete op2;
-			return op1;
-		}
-	} else if(expr->kind == Expr::Kind::sin) {
-		if(op1->kind == Expr::Kind::number) {
-			op1->num = sin(op1->num);
-			return op1;
-		}
-	} else if(expr->kind == Expr::Kind::cos) {
-		if(op1->kind == Expr::Kind::number) {
-			op1->num = cos(op1->num);
-			return op1;
-		}
-	} else if(expr->kind == Expr::Kind::tan) {
-		if(op1->kind == Expr::Kind::number) {
-			op1->num = tan(op1->num);
-			return op1;
-		}
-	} else if(expr->kind == Expr::Kind::exp) {
-		if(op1->kind == Expr::Kind::number) {
-			op1->num = exp(op1->num);
-			return op1;
-		}
-	} else if(expr->kind == Expr::Kind::ln) {
-		if(op1->kind == Expr::Kind::number) {
-			op1->num = log(op1->num);
-			return op1;
+void QASMsimulator::PushOp(ParamExpr& expr, ParamExpr::Op op, int index) {
+	// appends an operation to the postfix code of expr; if its operands are constants, it is evaluated
+	// right away and its result replaces the first operand (e.g., pi/2 or -lambda/2 with lambda
+	// substituted)
+	bool binary = op == ParamExpr::Op::plus || op == ParamExpr::Op::minus || op == ParamExpr::Op::times
+			|| op == ParamExpr::Op::div || op == ParamExpr::Op::power;
+	unsigned int operands = op == ParamExpr::Op::number || op == ParamExpr::Op::param ? 0 : (binary ? 2 : 1);
+	std::vector<std::pair<ParamExpr::Op, int> >& code = expr.code;
+	if(operands == 0 || code.size() < operands || code.back().first != ParamExpr::Op::number
+			|| code[code.size() - operands].first != ParamExpr::Op::number) {
+		code.push_back(std::make_pair(op, index));
+		return;
+	}
+
+	int x = code[code.size() - operands].second, y = code.back().second;
+	code.resize(code.size() - operands + 1);
+	ApplyOp(op, constants_double[x], constants_double[y]);
+	if(!double_parameters) {
+		ApplyOp(op, constants[x], constants[y]);
+	}
+}
+
+void QASMsimulator::SubstituteParams(ParamExpr& expr, std::vector<ParamExpr>& params, ParamExpr& result) {
+	// sets result to expr with every parameter replaced by the code of the corresponding expression
+	// in params (in terms of the parameters of the calling gate); the constants are copied
+	auto push = [&](std::pair<ParamExpr::Op, int>& code) {
+		if(code.first == ParamExpr::Op::number) {
+			int index = AddConstant(constants_double[code.second]);
+			if(!double_parameters) {
+				constants[index] = constants[code.second];
+			}
+			PushOp(result, code.first, index);
+		} else {
+			PushOp(result, code.first, code.second);
 		}
-	} else if(expr->kind == Expr::Kind::sqrt) {
-		if(op1->kind == Expr::Kind::number) {
-			op1->num = sqrt(op1->num);
-			return op1;
+	};
+	for(auto it = expr.code.begin(); it != expr.code.end(); it++) {
+		if(it->first == ParamExpr::Op::param) {
+			ParamExpr& p = params[it->second];
+			for(auto it2 = p.code.begin(); it2 != p.code.end(); it2++) {
+				push(*it2);
+			}
+		} else {
+			push(*it);
 		}
-	} else if(expr->kind == Expr::Kind::id) {
-		return new Expr(*exprMap[expr->id]);
 	}
+}
+
+template<typename T> void QASMsimulator::ApplyOp(ParamExpr::Op op, T& x, const T& y) {
+	// x = x op y, unary operations ignore y
+	using std::sin;
+	using std::cos;
+	using std::tan;
+	using std::exp;
+	using std::log;
+	using std::sqrt;
+	using std::pow;
+	switch(op) {
+	case ParamExpr::Op::plus:
+		x += y;
+		break;
+	case ParamExpr::Op::minus:
+		x -= y;
+		break;
+	case ParamExpr::Op::times:
+		x *= y;
+		break;
+	case ParamExpr::Op::div:
+		x /= y;
+		break;
+	case ParamExpr::Op::power:
+		x = pow(x, y);
+		break;
+	case ParamExpr::Op::sign:
+		x = -x;
+		break;
+	case ParamExpr::Op::sin:
+		x = sin(x);
+		break;
+	case ParamExpr::Op::cos:
+		x = cos(x);
+		break;
+	case ParamExpr::Op::tan:
+		x = tan(x);
+		break;
+	case ParamExpr::Op::exp:
+		x = exp(x);
+		break;
+	case ParamExpr::Op::ln:
+		x = log(x);
+		break;
+	case ParamExpr::Op::sqrt:
+		x = sqrt(x);
+		break;
+	default:
+		break;
+	}
+}
 
-	return new Expr(expr->kind, op1, op2, expr->num, expr->id);
+template<typename T> T QASMsimulator::EvaluateParams(ParamExpr& expr, std::vector<T>& params, std::vector<T>& values, std::vector<T>& stack) {
+	// evaluates the postfix code of expr for the given values of the parameters and the constants
+	// (constants_double or constants), the entries of stack are reused
+	if(stack.size() < expr.code.size()) {
+		stack.resize(expr.code.size());
+	}
+	unsigned int n = 0;
+	for(auto it = expr.code.begin(); it != expr.code.end(); it++) {
+		if(it->first == ParamExpr::Op::number) {
+			stack[n++] = values[it->second];
+		} else if(it->first == ParamExpr::Op::param) {
+			stack[n++] = params[it->second];
+		} else if(it->first == ParamExpr::Op::plus || it->first == ParamExpr::Op::minus || it->first == ParamExpr::Op::times
+				|| it->first == ParamExpr::Op::div || it->first == ParamExpr::Op::power) {
+			n--;
+			ApplyOp(it->first, stack[n - 1], stack[n]);
+		} else {
+			ApplyOp(it->first, stack[n - 1], stack[n - 1]);
+		}
+	}
+	return n == 0 ? T(0) : stack[0];
 }
 
 void QASMsimulator::QASMopaqueGateDecl() {
@@ -694,21 +1191,32 @@ void QASMsimulator::QASMgateDecl() {
 	}
 	QASMidList(gate.argumentNames);
 	check(Token::Kind::lbrace);
-
+	parameter_names = &gate.parameterNames;
+
+	// arguments of the gate are referred to by their index
+	auto argument = [&](std::string name) {
+		auto it = std::find(gate.argumentNames.begin(), gate.argumentNames.end(), name);
+		if(it == gate.argumentNames.end()) {
+			std::cerr << "Undefined argument in gate declaration: " << name << std::endl;
+			exit(1);
+		}
+		return (int)(it - gate.argumentNames.begin());
+	};
 
 	while(sym != Token::Kind::rbrace) {
 		if(sym == Token::Kind::ugate) {
 			scan();
+			GateOp u(GateOp::Kind::U);
 			check(Token::Kind::lpar);
-			Expr* theta = QASMexp();
+			QASMexp(u.theta);
 			check(Token::Kind::comma);
-			Expr* phi = QASMexp();
+			QASMexp(u.phi);
 			check(Token::Kind::comma);
-			Expr* lambda = QASMexp();
+			QASMexp(u.lambda);
 			check(Token::Kind::rpar);
 			check(Token::Kind::identifier);
-
-			gate.gates.push_back(new Ugate(theta, phi, lambda, t.str));
+			u.args.push_back(argument(t.str));
+			gate.ops.push_back(u);
 			check(Token::Kind::semicolon);
 		} else if(sym == Token::Kind::cxgate) {
 			scan();
@@ -716,14 +1224,16 @@ void QASMsimulator::QASMgateDecl() {
 			std::string control = t.str;
 			check(Token::Kind::comma);
 			check(Token::Kind::identifier);
-			gate.gates.push_back(new CXgate(control, t.str));
+			GateOp cx(GateOp::Kind::CX);
+			cx.args = {argument(control), argument(t.str)};
+			gate.ops.push_back(cx);
 			check(Token::Kind::semicolon);
 
 		} else if(sym == Token::Kind::identifier) {
 			scan();
 			std::string name = t.str;
 
-			std::vector<Expr* > parameters;
+			std::vector<ParamExpr> parameters;
 			std::vector<std::string> arguments;
 			if(sym == Token::Kind::lpar) {
 				scan();
@@ -735,29 +1245,48 @@ void QASMsimulator::QASMgateDecl() {
 			QASMidList(arguments);
 			check(Token::Kind::semicolon);
 
-			CompoundGate g = compoundGates[name];
-			std::map<std::string, std::string> argsMap;
-			for(unsigned int i = 0; i < arguments.size(); i++) {
-				argsMap[g.argumentNames[i]] = arguments[i];
+			auto gateIt = compoundGates.find(name);
+			if(gateIt == compoundGates.end()) {
+				std::cerr << "Undefined gate: " << name << std::endl;
+				exit(1);
 			}
-
-			std::map<std::string, Expr*> paramsMap;
-			for(unsigned int i = 0; i < parameters.size(); i++) {
-				paramsMap[g.parameterNames[i]] = parameters[i];
+			CompoundGate& g = gateIt->second;
+			if(parameters.size() != g.parameterNames.size() || arguments.size() != g.argumentNames.size()) {
+				std::cerr << "Wrong number of parameters or arguments for gate " << name << "!" << std::endl;
+				exit(1);
 			}
 
-			for(auto it = g.gates.begin(); it != g.gates.end(); it++) {
-				if(Ugate* u = dynamic_cast<Ugate*>(*it)) {
-					gate.gates.push_back(new Ugate(RewriteExpr(u->theta, paramsMap), RewriteExpr(u->phi, paramsMap), RewriteExpr(u->lambda, paramsMap), argsMap[u->target]));
-				} else if(CXgate* cx = dynamic_cast<CXgate*>(*it)) {
-					gate.gates.push_back(new CXgate(argsMap[cx->control], argsMap[cx->target]));
-				} else {
-					std::cerr << "Unexpected gate!" << std::endl;
-				}
+			// the body of the called gate is expanded with its arguments and parameters substituted
+			std::vector<int> args;
+			for(auto it = arguments.begin(); it != arguments.end(); it++) {
+				args.push_back(argument(*it));
 			}
 
-			for(auto it = parameters.begin(); it != parameters.end(); it++) {
-				delete *it;
+			if(!generic_gates && (!g.xline.empty() || g.diagonal) && g.ops.size() > 1) {
+				// keep the call (e.g., of ccx or cz) so that it can be applied without multiplication
+				GateOp x(GateOp::Kind::special);
+				x.args = args;
+				x.xline = g.xline;
+				x.phase = g.xphase;
+				x.diag = g.diag;
+				x.length = g.ops.size();
+				gate.ops.push_back(x);
+			}
+			for(auto it = g.ops.begin(); it != g.ops.end(); it++) {
+				GateOp op(it->kind);
+				for(auto it2 = it->args.begin(); it2 != it->args.end(); it2++) {
+					op.args.push_back(args[*it2]);
+				}
+				if(it->kind == GateOp::Kind::U) {
+					SubstituteParams(it->theta, parameters, op.theta);
+					SubstituteParams(it->phi, parameters, op.phi);
+					SubstituteParams(it->lambda, parameters, op.lambda);
+				}
+				op.xline = it->xline;
+				op.phase = it->phase;
+				op.diag = it->diag;
+				op.length = it->length;
+				gate.ops.push_back(op);
 			}
 		} else if(sym == Token::Kind::barrier) {
 			scan();
@@ -770,89 +1299,25 @@ void QASMsimulator::QASMgateDecl() {
 		}
 	}
 
-#if VERBOSE & 0
-	std::cout << "Declared gate \"" << gateName << "\":" << std::endl;
-	for(auto it = gate.gates.begin(); it != gate.gates.end(); it++) {
-		if(Ugate* u = dynamic_cast<Ugate*>(*it)) {
-			std::cout << "  U(";
-			printExpr(u->theta);
-			std::cout << ", ";
-			printExpr(u->phi);
-			std::cout << ", ";
-			printExpr(u->lambda);
-			std::cout << ") "<< u->target << ";" << std::endl;
-		} else if(CXgate* cx = dynamic_cast<CXgate*>(*it)) {
-			std::cout << "  CX " << cx->control << ", " << cx->target << ";" << std::endl;
-		} else {
-			std::cout << "other gate" << std::endl;
-		}
+	// CX a,b; CX b,a; CX a,b (also with a and b exchanged) swaps the two arguments
+	if(gate.parameterNames.empty() && gate.argumentNames.size() == 2 && gate.ops.size() == 3 && gate.argumentNames[0] != gate.argumentNames[1]) {
+		std::vector<GateOp>& cx = gate.ops;
+		gate.swap = cx[0].kind == GateOp::Kind::CX && cx[1].kind == GateOp::Kind::CX && cx[2].kind == GateOp::Kind::CX
+				&& cx[0].args[0] != cx[0].args[1]
+				&& cx[1].args[0] == cx[0].args[1] && cx[1].args[1] == cx[0].args[0]
+				&& cx[2].args == cx[0].args;
 	}
-#endif
+	parameter_names = NULL;
+	CheckSpecialGate(gate);
 
 	compoundGates[gateName] = gate;
 
 	check(Token::Kind::rbrace);
 }
 
-void QASMsimulator::printExpr(Expr* expr) {
-	if(expr->kind == Expr::Kind::number) {
-		std::cout << expr->num;
-	} else if(expr->kind == Expr::Kind::plus) {
-		printExpr(expr->op1);
-		std::cout << " + ";
-		printExpr(expr->op2);
-	} else if(expr->kind == Expr::Kind::minus) {
-		printExpr(expr->op1);
-		std::cout << " - ";
-		printExpr(expr->op2);
-	} else if(expr->kind == Expr::Kind::sign) {
-		std::cout << "( - ";
-		printExpr(expr->op1);
-		std::cout << " )";
-	} else if(expr->kind == Expr::Kind::times) {
-		printExpr(expr->op1);
-		std::cout << " * ";
-		printExpr(expr->op2);
-	} else if(expr->kind == Expr::Kind::div) {
-		printExpr(expr->op1);
-		std::cout << " / ";
-		printExpr(expr->op2);
-	} else if(expr->kind == Expr::Kind::power) {
-		printExpr(expr->op1);
-		std::cout << " ^ ";
-		printExpr(expr->op2);
-	} else if(expr->kind == Expr::Kind::sin) {
-		std::cout << "sin(";
-		printExpr(expr->op1);
-		std::cout << ")";
-	} else if(expr->kind == Expr::Kind::cos) {
-		std::cout << "cos(";
-		printExpr(expr->op1);
-		std::cout << ")";
-	} else if(expr->kind == Expr::Kind::tan) {
-		std::cout << "tan(";
-		printExpr(expr->op1);
-		std::cout << ")";
-	} else if(expr->kind == Expr::Kind::exp) {
-		std::cout << "exp(";
-		printExpr(expr->op1);
-		std::cout << ")";
-	} else if(expr->kind == Expr::Kind::ln) {
-		std::cout << "ln(";
-		printExpr(expr->op1);
-		std::cout << ")";
-	} else if(expr->kind == Expr::Kind::sqrt) {
-		std::cout << "sqrt(";
-		printExpr(expr->op1);
-		std::cout << ")";
-	} else if(expr->kind == Expr::Kind::id) {
-		std::cout << expr->id;
-	}
-}
-
-void QASMsimulator::QASMqop(bool execute) {
+void QASMsimulator::QASMqop() {
 	if(sym == Token::Kind::ugate || sym == Token::Kind::cxgate || sym == Token::Kind::identifier) {
-		QASMgate(execute);
+		QASMgate();
 	} else if(sym == Token::Kind::measure) {
 		scan();
 		std::pair<int, int> qreg = QASMargumentQreg();
@@ -862,20 +1327,22 @@ void QASMsimulator::QASMqop(bool execute) {
 		std::pair<std::string, int> creg = QASMargumentCreg();
 		check(Token::Kind::semicolon);
 
-		if(execute) {
-			int creg_size = (creg.second == -1) ? cregs[creg.first].first : 1;
+		int creg_size = (creg.second == -1) ? cregs[creg.first].second : 1;
 
-			if(qreg.second == creg_size) {
-				if(creg_size == 1) {
-					cregs[creg.first].second[creg.second] = MeasureOne(nqubits-1-(qreg.first));
-				} else {
-					for(int i = 0; i < creg_size; i++) {
-						cregs[creg.first].second[i] = MeasureOne(nqubits-1-(qreg.first+i));
-					}
-				}
+		if(qreg.second == creg_size) {
+			Instruction measure(Instruction::Kind::measure);
+			if(creg_size == 1) {
+				measure.qubits.push_back(qreg.first);
+				measure.values.push_back(cregs[creg.first].first + creg.second);
 			} else {
-				std::cerr << "Mismatch of qreg and creg size in measurement" << std::endl;
+				for(int i = 0; i < creg_size; i++) {
+					measure.qubits.push_back(qreg.first+i);
+					measure.values.push_back(cregs[creg.first].first + i);
+				}
 			}
+			Emit(measure);
+		} else {
+			std::cerr << "Mismatch of qreg and creg size in measurement" << std::endl;
 		}
 	} else if(sym == Token::Kind::reset) {
 		scan();
@@ -883,23 +1350,401 @@ void QASMsimulator::QASMqop(bool execute) {
 
 		check(Token::Kind::semicolon);
 
-		if(execute) {
-			for(int i = 0; i < qreg.second; i++) {
-				ResetQubit(nqubits-1-(qreg.first+i));
+		Instruction reset(Instruction::Kind::reset);
+		for(int i = 0; i < qreg.second; i++) {
+			reset.qubits.push_back(qreg.first+i);
+		}
+		Emit(reset);
+	}
+}
+
+void QASMsimulator::MeasureBranching(std::vector<std::pair<int, int*> >& targets, unsigned int k, bool nested) {
+	// measures the targets from index k on; with branching enabled, the shots taking the current
+	// branch are split between the outcomes and the rest of the program is executed once per
+	// outcome that occurs (a nested branch is finished once the program has been executed)
+
+	for(; k < targets.size(); k++) {
+		if(!branching || branch_shots <= 1) {
+			if(k + 1 == targets.size()) {
+				*targets[k].second = MeasureOne(targets[k].first);
+			} else {
+				std::vector<int> qubits;
+				for(unsigned int i = k; i < targets.size(); i++) {
+					qubits.push_back(targets[i].first);
+				}
+				std::vector<int> outcome = MeasureQubits(qubits);
+				for(unsigned int i = k; i < targets.size(); i++) {
+					*targets[i].second = outcome[i - k];
+				}
 			}
+			break;
 		}
 
+		std::pair<mpreal, mpreal> probs = MeasurementProbabilities(targets[k].first);
+		mpreal sum = probs.first + probs.second;
+
+		// as the splits of SampleAll, the split draws from the stream of the outcomes of the branch so far
+		PhiloxStream draws(rng, rng_stream);
+		std::binomial_distribution<unsigned long long> binomial(branch_shots, std::min(1.0, (probs.first / sum).toDouble()));
+		unsigned long long zeros = binomial(draws);
+
+		if(zeros == 0 || zeros == branch_shots) {
+			int outcome = (zeros == 0) ? 1 : 0;
+			NextStream(outcome);
+			CollapseQubit(targets[k].first, outcome, outcome ? probs.second : probs.first);
+			*targets[k].second = outcome;
+			continue;
+		}
+
+		unsigned int pc_saved = pc;
+		std::vector<int> cbits_saved = cbits;
+		BranchState state;
+		SaveState(state);
+
+		unsigned long long shots = branch_shots;
+		branched = true;
+
+		branch_shots = zeros;
+		NextStream(0);
+		CollapseQubit(targets[k].first, 0, probs.first);
+		*targets[k].second = 0;
+		MeasureBranching(targets, k+1, true);
+
+		pc = pc_saved;
+		std::copy(cbits_saved.begin(), cbits_saved.end(), cbits.begin());
+		RestoreState(state);
+
+		branch_shots = shots - zeros;
+		NextStream(1);
+		CollapseQubit(targets[k].first, 1, probs.second);
+		*targets[k].second = 1;
+		MeasureBranching(targets, k+1, true);
+		return;
+	}
+
+	if(nested) {
+		// a branch that is split again later on is finished by its sub-branches
+		branched = false;
+		Execute();
+		if(!branched) {
+			FinishBranch();
+		}
+		branched = true;
+	}
+}
+
+void QASMsimulator::FinishBranch() {
+	min_fidelity = std::min(min_fidelity, GetFidelity());
+	SampleAll(branch_shots, *branch_counts);
+}
+
+void QASMsimulator::InteractionOrder() {
+	// collects the interactions between the arguments of all gate calls of the compiled program;
+	// the qubits are ordered by reverse Cuthill-McKee on the interaction graph, such that interacting
+	// qubits end up on nearby levels, and the order is flipped if more controls (all but the last
+	// argument of a gate) are then below their targets than above
+	int n = compiled_qubits;
+	std::vector<std::map<int, int> > graph(n);
+	std::map<std::pair<int, int>, int> controls;	// (control, target) -> number of gates
+
+	for(auto args = gate_arguments.begin(); args != gate_arguments.end(); args++) {
+		int size = 1;
+		for(auto it = args->begin(); it != args->end(); it++) {
+			size = std::max(size, it->second);
+		}
+		for(int i = 0; i < size && args->size() > 1; i++) {
+			std::vector<int> qubits;
+			for(auto it = args->begin(); it != args->end(); it++) {
+				qubits.push_back(it->first + (it->second > 1 ? i : 0));
+			}
+			for(unsigned int j = 0; j < qubits.size(); j++) {
+				for(unsigned int k = j + 1; k < qubits.size(); k++) {
+					if(qubits[j] != qubits[k] && qubits[j] < n && qubits[k] < n) {
+						graph[qubits[j]][qubits[k]]++;
+						graph[qubits[k]][qubits[j]]++;
+						if(k == qubits.size() - 1) {
+							controls[std::make_pair(qubits[j], qubits[k])]++;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// Cuthill-McKee: breadth-first search from a vertex of minimum degree, visiting neighbors by increasing degree
+	std::vector<int> order;
+	std::vector<bool> visited(n, false);
+	while((int)order.size() < n) {
+		int start = -1;
+		for(int q = 0; q < n; q++) {
+			if(!visited[q] && (start < 0 || graph[q].size() < graph[start].size())) {
+				start = q;
+			}
+		}
+		visited[start] = true;
+		order.push_back(start);
+		for(unsigned int head = order.size() - 1; head < order.size(); head++) {
+			std::vector<int> neighbors;
+			for(auto it = graph[order[head]].begin(); it != graph[order[head]].end(); it++) {
+				if(!visited[it->first]) {
+					neighbors.push_back(it->first);
+				}
+			}
+			std::stable_sort(neighbors.begin(), neighbors.end(), [&](int a, int b) {
+				return graph[a].size() < graph[b].size();
+			});
+			for(auto it = neighbors.begin(); it != neighbors.end(); it++) {
+				visited[*it] = true;
+				order.push_back(*it);
+			}
+		}
+	}
+	std::reverse(order.begin(), order.end());
+
+	std::vector<int> rank(n);
+	for(int l = 0; l < n; l++) {
+		rank[order[l]] = l;
 	}
+	long long above = 0;
+	for(auto it = controls.begin(); it != controls.end(); it++) {
+		above += (rank[it->first.first] > rank[it->first.second]) ? it->second : -it->second;
+	}
+	if(above < 0) {
+		std::reverse(order.begin(), order.end());
+	}
+	SetVariableOrder(order);
 }
 
 void QASMsimulator::Simulate() {
+	Compile();
+	pc = 0;
+	Execute();
+}
+
+void QASMsimulator::Compile() {
+	// parses the program once into a list of instructions, in which gate declarations are expanded,
+	// qubits and classical bits are resolved and the matrices of the gates are evaluated
+	if(compiled) {
+		return;
+	}
+	compiled = true;
 
 	scan();
 	check(Token::Kind::openqasm);
 	check(Token::Kind::real);
 	check(Token::Kind::semicolon);
 
-	do {
+	CompileStatements();
+
+	// measurements are intermediate if a gate follows one of them (under any condition); snapshots,
+	// resets and register declarations do not change the measured state that the shots are sampled from
+	bool measured = false;
+	for(auto it = program.begin(); it != program.end() && !intermediate_measurement; it++) {
+		switch(it->kind) {
+		case Instruction::Kind::measure:
+			measured = true;
+			break;
+		case Instruction::Kind::U:
+		case Instruction::Kind::CX:
+		case Instruction::Kind::swap:
+		case Instruction::Kind::permutation:
+		case Instruction::Kind::diagonal:
+			intermediate_measurement = measured;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+void QASMsimulator::Emit(Instruction& instruction) {
+	// appends an instruction to the program, under the condition of the if statement compiled
+	if(if_offset >= 0) {
+		instruction.cond_offset = if_offset;
+		instruction.cond_size = if_size;
+		instruction.cond_value = if_value;
+	}
+	program.push_back(instruction);
+}
+
+void QASMsimulator::Execute() {
+	// executes the program from instruction pc on
+	while(pc < program.size()) {
+		Instruction& instruction = program[pc++];
+
+		if(instruction.cond_offset >= 0) {
+			int creg_num = 0;
+			for(int i = instruction.cond_size-1; i >= 0; i--) {
+				creg_num = (creg_num << 1) | (cbits[instruction.cond_offset + i] & 1);
+			}
+			if(creg_num != instruction.cond_value) {
+				continue;
+			}
+		}
+
+		std::vector<int>& qubits = instruction.qubits;
+		switch(instruction.kind) {
+		case Instruction::Kind::qreg:
+			AddVariables(instruction.values[0], instruction.name);
+			break;
+		case Instruction::Kind::U: {
+			tmp_matrix[0][0] = instruction.weights[0];
+			tmp_matrix[0][1] = instruction.weights[1];
+			tmp_matrix[1][0] = instruction.weights[2];
+			tmp_matrix[1][1] = instruction.weights[3];
+			line[qubit_var[qubits[0]]] = 2;
+			QMDDedge f = QMDDmvlgate(tmp_matrix, nqubits, line);
+			line[qubit_var[qubits[0]]] = -1;
+			ApplyGate(f);
+			break;
+		}
+		case Instruction::Kind::CX:
+			ApplyCX(qubits[0], qubits[1]);
+			break;
+		case Instruction::Kind::swap:
+			if(!SwapQubits(qubits[0], qubits[1])) {
+				ApplyCX(qubits[0], qubits[1]);
+				ApplyCX(qubits[1], qubits[0]);
+				ApplyCX(qubits[0], qubits[1]);
+			}
+			break;
+		case Instruction::Kind::permutation:
+			for(unsigned int j = 0; j < qubits.size(); j++) {
+				line[qubit_var[qubits[j]]] = instruction.values[j];
+			}
+			ApplyPermutation(instruction.weights[0]);
+			for(unsigned int j = 0; j < qubits.size(); j++) {
+				line[qubit_var[qubits[j]]] = -1;
+			}
+			break;
+		case Instruction::Kind::diagonal:
+			ApplyDiagonal(qubits, instruction.weights);
+			break;
+		case Instruction::Kind::measure: {
+			std::vector<std::pair<int, int*> > targets;
+			for(unsigned int j = 0; j < qubits.size(); j++) {
+				targets.push_back(std::make_pair(qubits[j], &cbits[instruction.values[j]]));
+			}
+			MeasureBranching(targets, 0, false);
+			break;
+		}
+		case Instruction::Kind::reset:
+			for(auto it = qubits.begin(); it != qubits.end(); it++) {
+				ResetQubit(*it);
+			}
+			break;
+		case Instruction::Kind::snapshot:
+			TakeSnapshot(instruction);
+			break;
+		case Instruction::Kind::probabilities:
+			PrintProbabilities();
+			break;
+		}
+	}
+}
+
+void QASMsimulator::TakeSnapshot(Instruction& instruction) {
+	int n = instruction.values[0];
+	std::vector<int>& qubits = instruction.qubits;
+	std::vector<std::pair<double, std::string> >& pauli_terms = instruction.pauli_terms;
+	std::set<int> distinct(qubits.begin(), qubits.end());
+
+	Snapshot* snapshot = new Snapshot();
+	if(!pauli_terms.empty()) {
+		std::vector<std::string> paulis;
+		for(auto it = pauli_terms.begin(); it != pauli_terms.end(); it++) {
+			std::string pauli(nqubits, 'I');
+			for(unsigned int i = 0; i < qubits.size(); i++) {
+				pauli[qubits[i]] = it->second[i];
+			}
+			paulis.push_back(pauli);
+		}
+		snapshot->expectation_values = ExpectationValues(paulis);
+		snapshot->expectation_value = 0;
+		for(unsigned int i = 0; i < pauli_terms.size(); i++) {
+			snapshot->expectation_value += pauli_terms[i].first * snapshot->expectation_values[i];
+		}
+	} else if(display_probabilities) {
+		snapshot->len = 1ull << (unsigned long long)qubits.size();
+		snapshot->probabilities = new double[snapshot->len];
+		GetMarginalProbabilities(qubits, snapshot->probabilities);
+		for(unsigned long long i = 0; i < snapshot->len; i++) {
+			if(snapshot->probabilities[i] > 0.0) {
+				std::stringstream ss;
+				for(int j = qubits.size()-1; j >= 0; j--) {
+					ss << ((i >> j) & 1);
+				}
+				snapshot->probabilities_ket[ss.str()] = snapshot->probabilities[i];
+			}
+		}
+	}
+	if(display_statevector && pauli_terms.empty()) {
+		if(qubits.size() != nqubits) {
+			std::cerr << "Snapshot must contain all qubits when containing statevector!" << std::endl;
+		} else {
+			snapshot->len = 1ull << (unsigned long long)qubits.size();
+			if(distinct.size() != nqubits) {
+				std::cerr << "Snapshot must contain all qubits when containing statevector!" << std::endl;
+			} else {
+				snapshot->statevector = new std::complex<double>[snapshot->len];
+				GetStatevector(qubits, snapshot->statevector);
+			}
+		}
+	}
+	if(sparse_statevector && pauli_terms.empty()) {
+		if(distinct.size() != nqubits || qubits.size() != nqubits) {
+			std::cerr << "Snapshot must contain all qubits when containing statevector!" << std::endl;
+		} else {
+			snapshot->sparse = true;
+			GetSparseStatevector(qubits, sparse_threshold, snapshot->statevector_ket);
+		}
+	}
+
+	if(display_overlaps) {
+		snapshot->state = circ.e;
+		RetainState(snapshot->state);
+		for(auto it = snapshots.begin(); it != snapshots.end(); it++) {
+			if(it->first == n) {
+				continue;
+			}
+			std::stringstream ss;
+			Cprint(QMDDinnerProduct(it->second->state, snapshot->state), ss);
+			snapshot->overlaps[it->first] = ss.str();
+			snapshot->fidelities[it->first] = QMDDfidelity(it->second->state, snapshot->state).toDouble();
+		}
+	}
+
+	if(snapshots.find(n) != snapshots.end()) {
+		delete snapshots[n];
+	}
+	snapshots[n] = snapshot;
+}
+
+void QASMsimulator::PrintProbabilities() {
+	std::cout << "Probabilities of the states |";
+	for(unsigned int i=0; i<nqubits; i++) {
+		std::cout << circ.line[i].variable << " ";
+	}
+	std::cout << ">:" << std::endl;
+	std::vector<int> qubits;
+	for(unsigned int i=0; i<nqubits; i++) {
+		qubits.push_back(i);
+	}
+	std::vector<double> probabilities(1ull << nqubits);
+	GetMarginalProbabilities(qubits, probabilities.data());
+	for(unsigned long long i=0; i<probabilities.size();i++) {
+		std::cout << "  |";
+		for(int j=nqubits-1; j >= 0; j--) {
+			std::cout << ((i >> j) & 1);
+		}
+		std::cout << ">: " << probabilities[i];
+		std::cout << std::endl;
+	}
+}
+
+void QASMsimulator::CompileStatements() {
+
+	while(sym != Token::Kind::eof) {
 		if(sym == Token::Kind::qreg) {
 
 			scan();
@@ -912,8 +1757,12 @@ void QASMsimulator::Simulate() {
 			check(Token::Kind::semicolon);
 			//check whether it already exists
 
-			qregs[s] = std::make_pair(nqubits, n);
-			AddVariables(n, s);
+			qregs[s] = std::make_pair(compiled_qubits, n);
+			compiled_qubits += n;
+			Instruction qreg(Instruction::Kind::qreg);
+			qreg.name = s;
+			qreg.values.push_back(n);
+			Emit(qreg);
 		} else if(sym == Token::Kind::creg) {
 			scan();
 			check(Token::Kind::identifier);
@@ -923,13 +1772,10 @@ void QASMsimulator::Simulate() {
 			int n = t.val;
 			check(Token::Kind::rbrack);
 			check(Token::Kind::semicolon);
-			int* reg = new int[n];
 
 			//Initialize cregs with 0
-			for(int i=0; i<n; i++) {
-				reg[i] = 0;
-			}
-			cregs[s] = std::make_pair(n, reg);
+			cregs[s] = std::make_pair(cbits.size(), n);
+			cbits.resize(cbits.size() + n, 0);
 
 		} else if(sym == Token::Kind::ugate || sym == Token::Kind::cxgate || sym == Token::Kind::identifier || sym == Token::Kind::measure || sym == Token::Kind::reset) {
 			QASMqop();
@@ -963,11 +1809,11 @@ void QASMsimulator::Simulate() {
 			if(it == cregs.end()) {
 				std::cerr << "Error in if statement: " << creg << " is not a creg!" << std::endl;
 			} else {
-				int creg_num = 0;
-				for(int i = it->second.first-1; i >= 0; i--) {
-					creg_num = (creg_num << 1) | (it->second.second[i] & 1);
-				}
-				QASMqop(creg_num == n);
+				if_offset = it->second.first;
+				if_size = it->second.second;
+				if_value = n;
+				QASMqop();
+				if_offset = -1;
 			}
 
 		} else if(sym == Token::Kind::snapshot) {
@@ -977,6 +1823,12 @@ void QASMsimulator::Simulate() {
 			int n = t.val;
 			check(Token::Kind::rpar);
 
+			std::vector<std::pair<double, std::string> > pauli_terms;
+			if(sym == Token::Kind::string) {
+				scan();
+				QASMpauliTerms(t.str, pauli_terms);
+			}
+
 			std::vector<std::pair<int, int> > arguments;
 			QASMargsList(arguments);
 
@@ -990,71 +1842,27 @@ void QASMsimulator::Simulate() {
 
 			//TODO: check whether no argument occurs twice!
 
-
-			Snapshot* snapshot = new Snapshot();
-			if(display_probabilities) {
-				snapshot->len = 1ull << (unsigned long long)arguments.size();
-				snapshot->probabilities = new double[snapshot->len];
-				for(unsigned long long i = 0; i < snapshot->len; i++) {
-					int j = arguments.size()-1;
-					for(auto it = arguments.begin(); it != arguments.end(); it++) {
-						line[nqubits-1-it->first] = (i >> j--) & 1;
-					}
-					snapshot->probabilities[i] = GetProbability().toDouble();
-					if(snapshot->probabilities[i] > 0.0) {
-						std::stringstream ss;
-						for(int j = arguments.size()-1; j >= 0; j--) {
-							ss << ((i >> j) & 1);
-						}
-						snapshot->probabilities_ket[ss.str()] = snapshot->probabilities[i];
-					}
-				}
-				for(auto it = arguments.begin(); it != arguments.end(); it++) {
-					line[nqubits-1-it->first] = -1;
-				}
+			Instruction snapshot(Instruction::Kind::snapshot);
+			snapshot.values.push_back(n);
+			for(auto it = arguments.begin(); it != arguments.end(); it++) {
+				snapshot.qubits.push_back(it->first);
 			}
-			if(display_statevector) {
-				if(arguments.size() != nqubits) {
-					std::cerr << "Snapshot must contain all qubits when containing statevector!" << std::endl;
-				} else {
-					snapshot->len = 1ull << (unsigned long long)arguments.size();
-					snapshot->statevector = new std::string[snapshot->len];
-
-					for(unsigned long long i = 0; i < snapshot->len; i++) {
-						unsigned long long entry = 0;
-						int j = arguments.size()-1;
-						for(auto it = arguments.begin(); it != arguments.end(); it++) {
-							entry |= ((i >> j--) & 1) << (nqubits-1-it->first);
-						}
-						uint64_t res = GetElementOfVector(entry);
-						std::stringstream ss;
-						Cprint(res, ss);
-						snapshot->statevector[i] = ss.str();
-					}
+			for(auto it = pauli_terms.begin(); it != pauli_terms.end(); it++) {
+				if(it->second.size() != arguments.size()) {
+					std::cerr << "ERROR in snapshot: Pauli string " << it->second << " does not match the number of arguments" << std::endl;
+					exit(1);
 				}
 			}
-
-			snapshots[n] = snapshot;
+			snapshot.pauli_terms = pauli_terms;
+			Emit(snapshot);
 		} else if(sym == Token::Kind::probabilities) {
-			std::cout << "Probabilities of the states |";
-			for(int i=nqubits-1; i>=0; i--) {
-				std::cout << circ.line[i].variable << " ";
-			}
-			std::cout << ">:" << std::endl;
-			for(int i=0; i<(1<<nqubits);i++) {
-				uint64_t res = GetElementOfVector(i);
-				std::cout << "  |";
-				for(int j=nqubits-1; j >= 0; j--) {
-					std::cout << ((i >> j) & 1);
-				}
-				std::cout << ">: " << Cmag[res & 0x7FFFFFFF7FFFFFFFull]*Cmag[res & 0x7FFFFFFF7FFFFFFFull];
-				std::cout << std::endl;
-			}
+			Instruction probabilities(Instruction::Kind::probabilities);
+			Emit(probabilities);
 			scan();
 			check(Token::Kind::semicolon);
 		} else {
             std::cerr << "ERROR: unexpected statement: started with " << Token::KindNames[sym] << "!" << std::endl;
             exit(1);
 		}
-	} while (sym != Token::Kind::eof);
+	}
 }
@@ -30,6 +30,8 @@ by citing the following publication:
 #include <QASMtoken.hpp>
 #include <Simulator.h>
 #include <stack>
+#include <random>
+#include <algorithm>
 
 class QASMsimulator : public Simulator {
 public:
@@ -40,87 +42,54 @@ public:
 	void Simulate();
 	void Simulate(int shots);
 	void Reset();
+	void SetDisplayOverlaps(bool display_overlaps) {
+		this->display_overlaps = display_overlaps;
+	}
+	void SetSparseStatevector(double threshold) {
+		this->sparse_statevector = true;
+		this->sparse_threshold = threshold;
+	}
+	void SetBinaryStatevector(std::string fname) {
+		this->binary_statevector = fname;
+	}
+	void SetInteractionOrder(bool interaction_order) {
+		this->interaction_order = interaction_order;
+	}
+	void SetGenericGates(bool generic_gates) {
+		this->generic_gates = generic_gates;
+	}
+	void SetDoubleParameters(bool double_parameters) {
+		this->double_parameters = double_parameters;
+	}
 
 private:
-	class Expr {
+	// parameter expression in postfix notation, the parameters of the gate are referred to by their
+	// index; operations on constants are folded while the code is built (see PushOp())
+	class ParamExpr {
 	public:
-		enum class Kind {number, plus, minus, sign, times, sin, cos, tan, exp, ln, sqrt, div, power, id};
-		mpreal num;
-		Kind kind;
-		Expr* op1 = NULL;
-		Expr* op2 = NULL;
-		std::string id;
-
-		Expr(Kind kind,  Expr* op1, Expr* op2, mpreal num, std::string id) {
-			this->kind = kind;
-			this->op1 = op1;
-			this->op2 = op2;
-			this->num = num;
-			this->id = id;
-		}
-
-		Expr(const Expr& expr) {
-			this->kind = expr.kind;
-			this->num = expr.num;
-			this->id = expr.id;
-			if(expr.op1 != NULL) {
-				this->op1 = new Expr(*expr.op1);
-			}
-			if(expr.op2 != NULL) {
-				this->op2 = new Expr(*expr.op2);
-			}
-		}
-
-		~Expr() {
-			if(op1 != NULL) {
-				delete op1;
-			}
-			if(op2 != NULL) {
-				delete op2;
-			}
-		}
+		enum class Op {number, param, plus, minus, sign, times, div, power, sin, cos, tan, exp, ln, sqrt};
+		std::vector<std::pair<Op, int> > code;	// number: index in constants, param: index of the parameter
 	};
 
-	class BasisGate {
+	// operation in the body of a gate declaration, its arguments are indices of the arguments of the gate
+	class GateOp {
 	public:
-		virtual ~BasisGate() = default;
-	};
-
-	class Ugate : public BasisGate {
-	public:
-		Expr* theta;
-		Expr* phi;
-		Expr* lambda;
-		std::string target;
-
-		Ugate(Expr* theta, Expr* phi, Expr* lambda, std::string target) {
-			this->theta = theta;
-			this->phi = phi;
-			this->lambda = lambda;
-			this->target = target;
-		}
-
-		~Ugate() {
-			if(theta != NULL) {
-				delete theta;
-			}
-			if(phi != NULL) {
-				delete phi;
-			}
-			if(lambda != NULL) {
-				delete lambda;
-			}
-		}
-	};
-
-	class CXgate : public BasisGate {
-	public:
-		std::string control;
-		std::string target;
-
-		CXgate(std::string control, std::string target) {
-			this->control = control;
-			this->target = target;
+		enum class Kind {U, CX, special};
+		Kind kind;
+		std::vector<int> args;			// U: target, CX: control and target, special: arguments of the call
+		ParamExpr theta, phi, lambda;	// U
+
+		// special: call of a gate whose body is a (controlled) X up to a global phase (xline per
+		// argument and phase) or diagonal (diag per basis state of the arguments, empty if it depends
+		// on parameters); the body follows as the next length operations and is applied instead if
+		// the arguments share qubits (and to evaluate the diagonal if diag is empty)
+		std::vector<int> xline;
+		std::complex<double> phase;
+		std::vector<std::complex<double> > diag;
+		unsigned int length = 0;
+
+		GateOp(Kind kind) {
+			this->kind = kind;
 		}
 	};
 
@@ -128,8 +97,33 @@ private:
 	public:
 		std::vector<std::string> parameterNames;
 		std::vector<std::string> argumentNames;
-		std::vector<BasisGate*> gates;
+		std::vector<GateOp> ops;	// body with all called gates expanded
 		bool opaque;
+		bool swap = false;	// the body exchanges its two arguments (three alternating CX gates)
+		std::vector<int> xline;		// if the body is a (controlled) X up to a global phase: line[] per argument
+		std::complex<double> xphase;
+		bool diagonal = false;		// the body is diagonal (for all values of the parameters)
+		std::vector<std::complex<double> > diag;	// without parameters: entry per basis state of the arguments
+	};
+
+	// instruction of a compiled program (see Compile()); qubits are given in declaration order and
+	// translated to decision diagram variables when the instruction is executed
+	class Instruction {
+	public:
+		enum class Kind {qreg, U, CX, swap, permutation, diagonal, measure, reset, snapshot, probabilities};
+		Kind kind;
+		std::vector<int> qubits;		// CX, swap: control and target
+		std::vector<int> values;		// permutation: line[] per qubit, measure: classical bit per qubit, qreg: size, snapshot: number
+		std::vector<uint64_t> weights;	// U: matrix (row-major), permutation: phase, diagonal: entries
+		int cond_offset = -1;			// if not negative, the instruction is only executed if the classical bits
+		int cond_size = 0;				// cond_offset, ..., cond_offset + cond_size - 1 have the value cond_value
+		int cond_value = 0;
+		std::string name;				// qreg
+		std::vector<std::pair<double, std::string> > pauli_terms;	// snapshot
+
+		Instruction(Kind kind) {
+			this->kind = kind;
+		}
 	};
 
 	class Snapshot {
@@ -145,8 +139,15 @@ private:
 
 		unsigned long long len;
 		double* probabilities;
-		std::string* statevector;
+		std::complex<double>* statevector;
+		bool sparse;
+		std::vector<std::pair<std::string, std::complex<double> > > statevector_ket;
 		std::map<std::string, double> probabilities_ket;
+		QMDDedge state;
+		std::map<int, std::string> overlaps;	// <earlier snapshot|this snapshot>
+		std::map<int, double> fidelities;
+		std::vector<double> expectation_values;	// <P> for every Pauli string of the snapshot
+		double expectation_value;				// weighted sum of the expectation values
 	};
 
 	void scan();
@@ -159,33 +160,92 @@ private:
   	std::istream* in;
 	QASMscanner* scanner;
 	std::map<std::string, std::pair<int ,int> > qregs;
-	std::map<std::string, std::pair<int, int*> > cregs;
+	std::map<std::string, std::pair<int, int> > cregs;	// offset in cbits and size
 	std::pair<int, int> QASMargumentQreg();
 	std::pair<std::string, int> QASMargumentCreg();
-	Expr* QASMexponentiation();
-	Expr* QASMfactor();
-	Expr* QASMterm();
-	QASMsimulator::Expr* QASMexp();
+	void QASMexponentiation(ParamExpr& expr);
+	void QASMfactor(ParamExpr& expr);
+	void QASMterm(ParamExpr& expr);
+	void QASMexp(ParamExpr& expr);
 	void QASMgateDecl();
 	void QASMopaqueGateDecl();
-	void QASMgate(bool execute = true);
-	void QASMqop(bool execute = true);
-	void QASMexpList(std::vector<Expr*>& expressions);
+	void QASMgate();
+	void QASMqop();
+	void QASMexpList(std::vector<ParamExpr>& expressions);
 	void QASMidList(std::vector<std::string>& identifiers);
+	void ApplyCX(int control, int target);
+	void PrintAmplitude(std::complex<double> c, std::ostream& os);
+	void QASMpauliTerms(std::string str, std::vector<std::pair<double, std::string> >& terms);
 	void QASMargsList(std::vector<std::pair<int, int> >& arguments);
+	void Compile();
+	void CompileStatements();
+	void Emit(Instruction& instruction);
+	void Execute();
+	void TakeSnapshot(Instruction& instruction);
+	void PrintProbabilities();
+	void MeasureBranching(std::vector<std::pair<int, int*> >& targets, unsigned int k, bool nested);
+	void FinishBranch();
+	void InteractionOrder();
+	void CheckSpecialGate(CompoundGate& gate);
+	bool EvaluateGates(std::vector<GateOp>& ops, unsigned int begin, unsigned int end, std::vector<int>& bit, std::vector<double>& params, std::vector<std::complex<double> >& m);
+	bool EvaluateDiagonal(std::vector<GateOp>& ops, unsigned int begin, unsigned int end, std::vector<int>& arguments, std::vector<double>& params, std::vector<std::complex<double> >& diag);
+	bool Diagonal(std::vector<std::complex<double> >& m, std::vector<std::complex<double> >& diag);
+	void EvaluateColumn(std::vector<GateOp>& ops, unsigned int begin, unsigned int end, std::vector<int>& arguments, std::vector<mpreal>& params, unsigned int col, std::vector<mpreal>& re, std::vector<mpreal>& im);
+	bool DisjointArguments(std::vector<std::pair<int, int> >& arguments);
+	void EmitU(mpreal theta, mpreal phi, mpreal lambda, int target);
+	void EmitU(double theta, double phi, double lambda, int target);
+	void EmitMatrix(uint64_t m[2][2], int target);
+	void EmitCX(int control, int target);
+	void EmitSpecialGate(std::vector<std::pair<int, int> >& arguments, std::vector<int>& xline, std::complex<double> phase, std::vector<std::complex<double> >& diag, std::vector<GateOp>& ops, unsigned int begin, unsigned int end, std::vector<int>& slots, std::vector<mpreal>& precise_params);
+	void EmitGates(std::vector<GateOp>& ops, unsigned int begin, unsigned int end, std::vector<std::pair<int, int> >& arguments, std::vector<double>& params, std::vector<mpreal>& precise_params);
+	int AddConstant(double value);
+	void PushOp(ParamExpr& expr, ParamExpr::Op op, int index);
+	void SubstituteParams(ParamExpr& expr, std::vector<ParamExpr>& params, ParamExpr& result);
+	template<typename T> T EvaluateParams(ParamExpr& expr, std::vector<T>& params, std::vector<T>& values, std::vector<T>& stack);
+	template<typename T> static void ApplyOp(ParamExpr::Op op, T& x, const T& y);
 	std::set<Token::Kind> unaryops {Token::Kind::sin,Token::Kind::cos,Token::Kind::tan,Token::Kind::exp,Token::Kind::ln,Token::Kind::sqrt};
 
 	QMDD_matrix tmp_matrix;
 
 	std::map<std::string, CompoundGate> compoundGates;
-	Expr* RewriteExpr(Expr* expr, std::map<std::string, Expr*>& exprMap);
-	void printExpr(Expr* expr);
+
+	// constants of all parameter expressions in double precision and, unless double_parameters is
+	// set, in the precision of the complex table; the stacks are reused by EvaluateParams()
+	std::vector<double> constants_double;
+	std::vector<mpreal> constants;
+	std::vector<double> stack_double;
+	std::vector<mpreal> stack;
+	std::vector<std::string>* parameter_names = NULL;	// parameters of the gate currently declared
 
 
 	bool display_statevector;
 	bool display_probabilities;
+	bool display_overlaps = false;
+	bool sparse_statevector = false;
+	double sparse_threshold = 0;
+	std::string binary_statevector;	// if set, state vectors are written to this file instead of the JSON output
+	bool interaction_order = false;	// order the qubits by their interactions instead of their declaration
+	bool generic_gates = false;		// multiply with all gates, also with permutations and diagonal gates
+	bool double_parameters = false;	// evaluate gate parameters and matrices in double precision
 
 	std::map<int, Snapshot*> snapshots;
+
+	// the program is compiled once and executed for every simulation (e.g., after Reset())
+	std::vector<Instruction> program;
+	bool compiled = false;
+	bool intermediate_measurement = false;	// a gate may be applied after a measurement
+	unsigned int pc = 0;			// next instruction to execute
+	int compiled_qubits = 0;		// qubits declared so far while compiling
+	int if_offset = -1, if_size = 0, if_value = 0;	// condition of the instructions currently compiled
+	std::vector<int> cbits;			// values of the classical bits of all cregs
+	std::vector<std::vector<std::pair<int, int> > > gate_arguments;	// arguments of all gate calls (for InteractionOrder())
+
+	// shot branching: with intermediate measurements, the shots are split between the outcomes
+	bool branching = false;					// split the shots at measurements
+	bool branched = false;					// a split occurred, i.e., all branches have been finished
+	unsigned long long branch_shots = 1;	// number of shots taking the current branch
+	std::map<std::string, int>* branch_counts = NULL;
+	double min_fidelity = 1.0;
 };
 
 #endif /* QASM_SIMULATOR_H_ */
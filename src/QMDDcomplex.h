@@ -141,6 +141,7 @@ mpreal QMDDcos(int fac, double div);
 mpreal QMDDsin(int fac, double div);
 void angle(mpfr_t, int); // computes angle for polar coordinate representation
 uint64_t Cmake(mpreal, mpreal); // make a complex value
+uint64_t CmakeDouble(double, double); // make a complex value from double precision parts
 mpreal Qmake(int,int,int); // returns the complex number equal to (a+b*sqrt(2))/c
 // required to be compatible with quadratic irrational-based 
 // complex number package
@@ -263,6 +263,15 @@ uint64_t Cmake(mpreal r,mpreal i)
   return Clookup(tmp_c);
 }
 
+uint64_t CmakeDouble(double r,double i)
+// make a complex value from double precision parts (without temporary mpreal values)
+{
+  mpfr_set_d(tmp_c.r, r, MPFR_RNDN);
+  mpfr_set_d(tmp_c.i, i, MPFR_RNDN);
+
+  return Clookup(tmp_c);
+}
+
 complex CmakeOne(void)
 {
 	complex c;
@@ -26,7 +26,24 @@ by citing the following publication:
 #define DEFINE_VARIABLES	// not only declare, but DEFINE global variables
 #include "QMDDpackage.h"
 #include "QMDDcomplex.h"
+#include <mutex>
 #include <set>
+#include <vector>
+
+#define AVAILBATCH 256			// no. of nodes moved from Avail to a thread-local available space chain at once
+
+static std::mutex AvailMutex;		// guards the (global) available space chain and localAvailChains
+
+// available space chain of a thread; registered in localAvailChains such that QMDDreturnLocalNodes
+// can move all chains back to Avail, and returned to Avail when the thread exits
+struct QMDDlocalAvail {
+	QMDDnodeptr head;
+	QMDDlocalAvail();
+	~QMDDlocalAvail();
+	void Return();	// moves the chain to Avail (AvailMutex has to be held)
+};
+static std::set<QMDDlocalAvail*> localAvailChains;
+static thread_local QMDDlocalAvail localAvail;	// available space chain of the current thread
 
 /***********************************************
 
@@ -695,7 +712,6 @@ QMDDedge QMDDutLookup(QMDDedge e) {
 //  only normalized nodes shall be stored.
 
 	intptr_t key;
-	int i;
 	unsigned int v;
 	QMDDnodeptr p;
 
@@ -705,59 +721,79 @@ QMDDedge QMDDutLookup(QMDDedge e) {
 		return (e);
 	}
 
-	UTlookups++;
+	if (!QMDDconcurrent)
+		UTlookups++;
 
-	key = 0;
-// note hash function shifts pointer values so that order is important
-// suggested by Dr. Nigel Horspool and helps significantly
-	for (i = 0; i < Nedge; i++)
-		key += ((intptr_t)(e.p->e[i].p) >> i) + (e.p->e[i].w >> 32) + e.p->e[i].w;
-	key = (key) & HASHMASK;
+	key = QMDDutKey(e.p);
 
 	//TODO: remove again after fixing hash function
-	UTkeys[key]++;
+	if (!QMDDconcurrent)
+		UTkeys[key]++;
 	v = (unsigned int) e.p->v;
-	p = Unique[v][key]; // find pointer to appropriate collision chain
-	//lastp=NULL;	    // pN: not necessary, don't need to jump back to predecessor
-	while (p != NULL)    // search for a match
-	{
-		if (memcmp(e.p->e, p->e, Nedge * sizeof(QMDDedge)) == 0) {
-			// Match found
-			e.p->next = Avail; 	// put node pointed to by e.p on avail chain
-			Avail = e.p;
-
-			// NOTE: reference counting is to be adjusted by function invoking the table lookup
-			UTmatch++;		// record hash table match
-
-			e.p = p;// and set it to point to node found (with weight unchanged)
-
-			if (p->renormFactor != COMPLEX_ONE) {
-				printf(
-						"Debug: table lookup found a node with active renormFactor with v=%d (id=%ld).\n",
-						p->v, (intptr_t) p);
-				if (p->ref != 0)
-					printf("was active!");
-				else
-					printf("was inactive!");
-				exit(66);
-				e.w = Cdiv(e.w, e.p->renormFactor);
+
+	std::atomic<QMDDnodeptr>& bucket = Unique[v][key];
+	QMDDnodeptr head = bucket.load(std::memory_order_acquire);
+	QMDDnodeptr stop = NULL;
+	char checked = 0;
+
+	for (;;) {
+		p = head; // find pointer to appropriate collision chain
+		while (p != stop)    // search for a match (nodes behind stop have already been checked)
+		{
+			if (memcmp(e.p->e, p->e, Nedge * sizeof(QMDDedge)) == 0) {
+				// Match found
+				e.p->next = localAvail.head; 	// put node pointed to by e.p on avail chain
+				localAvail.head = e.p;
+
+				// NOTE: reference counting is to be adjusted by function invoking the table lookup
+				if (!QMDDconcurrent)
+					UTmatch++;		// record hash table match
+
+				e.p = p;// and set it to point to node found (with weight unchanged)
+
+				if (p->renormFactor != COMPLEX_ONE) {
+					printf(
+							"Debug: table lookup found a node with active renormFactor with v=%d (id=%ld).\n",
+							p->v, (intptr_t) p);
+					if (p->ref != 0)
+						printf("was active!");
+					else
+						printf("was inactive!");
+					exit(66);
+					e.w = Cdiv(e.w, e.p->renormFactor);
+				}
+				return (e);
 			}
-			return (e);
+
+			if (!QMDDconcurrent)
+				UTcol++; 		// record hash collision
+			p = p->next;
+		}
+
+		// check if it is identity or diagonal before the node becomes visible to other threads
+		if (!checked) {
+			QMDDcheckSpecialMatrices(e);
+			checked = 1;
 		}
 
-		UTcol++; 		// record hash collision
-		//lastp=p;
-		p = p->next;
+		e.p->next = head; // if end of chain is reached, this is a new node
+		if (bucket.compare_exchange_weak(head, e.p, std::memory_order_release,
+				std::memory_order_acquire))
+			break;        // added it to front of collision chain
+		// another thread changed the chain - only the nodes in front of the old head are new
+		stop = e.p->next;
 	}
-	e.p->next = Unique[v][key]; // if end of chain is reached, this is a new node
-	Unique[v][key] = e.p;       // add it to front of collision chain
 
-	QMDDnodecount++;          // count that it exists
-	if (QMDDnodecount > QMDDpeaknodecount)
-		QMDDpeaknodecount = QMDDnodecount;
+	QMDDnodeptr level = UniqueNodes[v].load(std::memory_order_relaxed);
+	do {
+		e.p->levelNext = level;
+	} while (!UniqueNodes[v].compare_exchange_weak(level, e.p, std::memory_order_release,
+			std::memory_order_relaxed));
 
-	if (!QMDDterminal(e))
-		QMDDcheckSpecialMatrices(e); // check if it is identity or diagonal if nonterminal
+	int64_t count = ++QMDDnodecount;          // count that it exists
+	int64_t peak = QMDDpeaknodecount.load(std::memory_order_relaxed);
+	while (count > peak && !QMDDpeaknodecount.compare_exchange_weak(peak, count))
+		;
 
 	return (e);                // and return
 }
@@ -774,6 +810,12 @@ void QMDDinitComputeTable(void)
 	CTable_transpose.clear();
 	CTable_conjugateTranspose.clear();
 	CTable_renormalize.clear();
+	CTable_innerProduct.clear();
+	CTable_cofactor.clear();
+	CTable_restriction.clear();
+	CTable_exchange.clear();
+	CTable_permutation.clear();
+	CTable_diagonal.clear();
 
 	/*  for(i=0;i<CTSLOTS;i++)
 	 {
@@ -788,6 +830,72 @@ void QMDDinitComputeTable(void)
 	QMDDnullEdge.w = COMPLEX_ONE;
 }
 
+intptr_t QMDDutKey(QMDDnodeptr p)
+// returns the bucket of the unique table for a node with the edges of p
+		{
+	intptr_t key;
+	int i;
+
+	key = 0;
+// note hash function shifts pointer values so that order is important
+// suggested by Dr. Nigel Horspool and helps significantly
+	for (i = 0; i < Nedge; i++)
+		key += ((intptr_t)(p->e[i].p) >> i) + (p->e[i].w >> 32) + p->e[i].w;
+	return (key & HASHMASK);
+}
+
+void QMDDutInsert(QMDDnodeptr p)
+// puts p (which is not in the unique table) back into the unique table of its variable
+// without checking for a copy; must not be called concurrently
+		{
+	intptr_t key = QMDDutKey(p);
+
+	p->next = Unique[p->v][key];
+	Unique[p->v][key] = p;
+	p->levelNext = UniqueNodes[p->v];
+	UniqueNodes[p->v] = p;
+}
+
+void QMDDutRelease(QMDDnodeptr p)
+// places the inactive node p, which is neither in the unique table nor in the list of its
+// variable, on the available space chain; compute table entries may still refer to p, so the
+// compute table has to be cleared before the next operation
+		{
+	p->next = Avail;
+	Avail = p;
+	QMDDnodecount--;
+}
+
+QMDDlocalAvail::QMDDlocalAvail() : head(NULL) {
+	std::lock_guard<std::mutex> lock(AvailMutex);
+	localAvailChains.insert(this);
+}
+
+QMDDlocalAvail::~QMDDlocalAvail() {
+	std::lock_guard<std::mutex> lock(AvailMutex);
+	localAvailChains.erase(this);
+	Return();
+}
+
+void QMDDlocalAvail::Return() {
+	while (head != NULL) {
+		QMDDnodeptr p = head;
+		head = p->next;
+		p->next = Avail;
+		Avail = p;
+	}
+}
+
+void QMDDreturnLocalNodes(void)
+// moves the available space chains of all threads back to Avail; must not be called concurrently
+// with node allocations
+		{
+	std::lock_guard<std::mutex> lock(AvailMutex);
+	for (QMDDlocalAvail* chain : localAvailChains) {
+		chain->Return();
+	}
+}
+
 void QMDDgarbageCollect(void)
 // a simple garbage collector that removes nodes with 0 ref count from the unique
 // tables placing them on the available space chain
@@ -798,8 +906,11 @@ void QMDDgarbageCollect(void)
 
 	if (QMDDnodecount < GCcurrentLimit)
 		return; // do not collect if below GCcurrentLimit node count
+	QMDDreturnLocalNodes();
 	count = counta = 0;
 	//printf("starting garbage collector %d nodes\n",QMDDnodecount);
+	for (i = 0; i < MAXN; i++)
+		UniqueNodes[i] = NULL;	// rebuilt from the remaining nodes
 	for (i = 0; i < MAXN; i++)
 		for (j = 0; j < NBUCKET; j++) {
 			lastp = NULL;
@@ -818,6 +929,8 @@ void QMDDgarbageCollect(void)
 					Avail = p;
 					p = nextp;
 				} else {
+					p->levelNext = UniqueNodes[i];
+					UniqueNodes[i] = p;
 					lastp = p;
 					p = p->next;
 					counta++;
@@ -832,33 +945,62 @@ void QMDDgarbageCollect(void)
 
 QMDDnodeptr QMDDgetNode(void) {
 // get memory space for a node
-//
+// nodes are taken from the available space chain of the current thread which is
+// refilled from the global chain Avail (or by allocating 2000 new nodes) if empty
 	QMDDnodeptr r, r2;
 	int i, j;
 
-	if (Avail != NULL)	// get node from avail chain if possible
-	{
-		r = Avail;
-		Avail = Avail->next;
-	} else {			// otherwise allocate 2000 new nodes
+	if (localAvail.head == NULL) {
+		std::lock_guard<std::mutex> lock(AvailMutex);
+		if (Avail != NULL)	// get nodes from avail chain if possible
+		{
+			localAvail.head = r2 = Avail;
+			for (i = 1; i < AVAILBATCH && r2->next != NULL; i++)
+				r2 = r2->next;
+			Avail = r2->next;
+			r2->next = NULL;
+		}
+	}
+	if (localAvail.head == NULL) {			// otherwise allocate 2000 new nodes
 
 		//printf("no space available. allocate 2000 new nodes\n");
 
 		j = sizeof(QMDDnode);//+Nedge*sizeof(QMDDedge);				// estimated value of a QMDDnode ! DANGER ous. pN calculated 44=sizeof(QMDDnode)+Nedge*sizeof(QMDDedge)
 		r = (QMDDnodeptr) malloc(2000 * j);
-		r2 = (QMDDnodeptr) ((int64_t) r + j);
-		Avail = r2;
-		for (i = 0; i < 1998; i++, r2 = (QMDDnodeptr) ((int64_t) r2 + j)) {
+		r2 = r;
+		localAvail.head = r2;
+		for (i = 0; i < 1999; i++, r2 = (QMDDnodeptr) ((int64_t) r2 + j)) {
 			r2->next = (QMDDnodeptr) ((int64_t) r2 + j);
 		}
 		r2->next = NULL;
 	}
+	r = localAvail.head;
+	localAvail.head = r->next;
 	r->next = NULL;
 	r->ref = 0;			// set reference count to 0
 	r->ident = r->diag = r->block = 0;		// mark as not identity or diagonal
+	r->scratchEpoch = 0;	// scratch slots are invalid
 	return (r);
 }
 
+void QMDDscratchBegin(void)
+// invalidates the scratch slots of all nodes by starting a new epoch
+// (the slots are only reset explicitly when the epoch counter wraps around)
+		{
+	int i;
+	QMDDnodeptr p;
+
+	QMDDscratchEpoch++;
+	if (QMDDscratchEpoch != 0)
+		return;
+
+	for (i = 0; i < MAXN; i++)
+		for (p = UniqueNodes[i]; p != NULL; p = p->levelNext)
+			p->scratchEpoch = 0;
+	QMDDtnode->scratchEpoch = 0;
+	QMDDscratchEpoch = 1;
+}
+
 void QMDDincref(QMDDedge e)
 // increment reference counter for node e points to
 // and recursively increment reference counter for 
@@ -983,92 +1125,70 @@ void QMDDradixPrint(int p, int n)
 
 #define CThash(a,b) (((((int64_t)a.p+(int64_t)b.p)>>3)+(int)a.w+(int)b.w+(int)which)&CTMASK)
 
+static std::unordered_map<computeKey, QMDDedge, computeHasher>* CTselect(CTkind which) {
+// returns the compute table for the given operation or NULL if the operation is not supported
+	switch (which) {
+	case add:
+		return &CTable_add;
+	case mult:
+		return &CTable_mult;
+	case transpose:
+		return &CTable_transpose;
+	case conjugateTranspose:
+		return &CTable_conjugateTranspose;
+	case renormalize:
+		return &CTable_renormalize;
+	case innerProduct:
+		return &CTable_innerProduct;
+	case cofactor:
+		return &CTable_cofactor;
+	case restriction:
+		return &CTable_restriction;
+	case exchange:
+		return &CTable_exchange;
+	case permutation:
+		return &CTable_permutation;
+	case diagonal:
+		return &CTable_diagonal;
+	default:
+		std::cout << "unsupported operation: " << which << std::endl;
+		return NULL;
+	}
+}
+
 QMDDedge CTlookup(QMDDedge a, QMDDedge b, CTkind which) {
 // Lookup a computation in the compute table
 // return NULL if not a match else returns result of prior computation
-	//int i;
 	QMDDedge r;
 
 	r.p = NULL;
-	CTlook[which]++;
-	//i = CThash(a, b);
+	std::unordered_map<computeKey, QMDDedge, computeHasher>* table = CTselect(which);
+	if (table == NULL)
+		return r;
 
 	computeKey ck;
 	ck.a = a;
 	ck.b = b;
-	if (which == mult) {
-		std::unordered_map<computeKey, QMDDedge, computeHasher>::iterator it =
-				CTable_mult.find(ck);
-		if (it != CTable_mult.end()) {
-			CThit[which]++;
-			return it->second;
-		}
-	} else if (which == add) {
-		std::unordered_map<computeKey, QMDDedge, computeHasher>::iterator it =
-				CTable_add.find(ck);
-		if (it != CTable_mult.end()) {
-			CThit[which]++;
-			return it->second;
-		}
-	} else if (which == transpose) {
-		std::unordered_map<computeKey, QMDDedge, computeHasher>::iterator it =
-				CTable_transpose.find(ck);
-		if (it != CTable_mult.end()) {
-			CThit[which]++;
-			return it->second;
-		}
-	} else if (which == conjugateTranspose) {
-		std::unordered_map<computeKey, QMDDedge, computeHasher>::iterator it =
-				CTable_transpose.find(ck);
-		if (it != CTable_conjugateTranspose.end()) {
-			CThit[which]++;
-			return it->second;
-		}
-	} else if (which == renormalize) {
-		std::unordered_map<computeKey, QMDDedge, computeHasher>::iterator it =
-				CTable_transpose.find(ck);
-		if (it != CTable_renormalize.end()) {
-			CThit[which]++;
-			return it->second;
-		}
-	} else {
-		std::cout << "unsupported operation: " << which << std::endl;
+
+	CTlook[which]++;
+	std::unordered_map<computeKey, QMDDedge, computeHasher>::iterator it = table->find(ck);
+	if (it != table->end()) {
+		CThit[which]++;
+		return it->second;
 	}
 	return r;
-
-	/*  if(CTable[i].which!=which) return(r);
-	 if(CTable[i].a.p!=a.p||CTable[i].a.w!=a.w) return(r);
-	 if(CTable[i].b.p!=b.p||CTable[i].b.w!=b.w) return(r);
-	 if((CTable[i].r.p)->v==-1) return(r);
-  	 CThit[which]++;
-  return(CTable[i].r);
-  */
 }
 
 void CTinsert(QMDDedge a, QMDDedge b, QMDDedge r, CTkind which) {
 // put an entry into the compute table
-	//int i;
+	std::unordered_map<computeKey, QMDDedge, computeHasher>* table = CTselect(which);
+	if (table == NULL)
+		return;
+
 	computeKey ck;
 	ck.a = a;
 	ck.b = b;
-	if (which == mult) {
-		CTable_mult[ck] = r;
-	} else if (which == add) {
-		CTable_add[ck] = r;
-	} else if (which == transpose) {
-		CTable_transpose[ck] = r;
-	} else if (which == conjugateTranspose) {
-		CTable_conjugateTranspose[ck] = r;
-	} else if (which == renormalize) {
-		CTable_renormalize[ck] = r;
-	} else {
-		std::cout << "unsupported operation: " << which << std::endl;
-	}
-	/*  i=CThash(a,b);
-	 CTable[i].a=a;
-	 CTable[i].b=b;
-	 CTable[i].r=r;
-	 CTable[i].which=which;*/
+	(*table)[ck] = r;
 }
 
 int TThash(int n, int m, int t, int line[]) {
@@ -1283,6 +1403,7 @@ void QMDDinit(int verbose) {
 	CTlook[0] = CTlook[1] = CTlook[2] = CThit[0] = CThit[1] = CThit[2] = 0;	// zero CTable counters
 	Avail = NULL;				// set available node list to empty
 	Lavail = NULL;				// set available element list to empty
+	QMDDscratchEpoch = 1;			// scratch slots of new nodes (epoch 0) are invalid
 	QMDDtnode = QMDDgetNode();// create terminal node - note does not go in unique table
 	QMDDtnode->ident = 1;
 	QMDDtnode->diag = 1;
@@ -1301,9 +1422,11 @@ void QMDDinit(int verbose) {
 	QMDDone = QMDDmakeTerminal(COMPLEX_ONE);
 
 
-	for (i = 0; i < MAXN; i++)
+	for (i = 0; i < MAXN; i++) {
 		for (j = 0; j < NBUCKET; j++) // set unique tables to empty
 			Unique[i][j] = NULL;
+		UniqueNodes[i] = NULL;
+	}
 	for (i = 0; i < MAXN; i++) //  set initial variable order to 0,1,2... from bottom up
 			{
 		QMDDorder[i] = QMDDinvorder[i] = i;
@@ -1640,6 +1763,382 @@ QMDDedge QMDDconjugateTranspose(QMDDedge a)
 	return (r);
 }
 
+static uint64_t QMDDinnerProduct2(QMDDedge x, QMDDedge y, int var)
+// inner product <x|y> of two vectors (stored in the first column of the QMDDs)
+// var is number of variables
+// a variable without a node in a vector has value 0 (e.g., a register added after a snapshot)
+// results are memoized for the pair of nodes and var (as terminal edges in the compute table)
+		{
+	QMDDedge e1, e2, r, k;
+	int i, w;
+	uint64_t weight, sum;
+
+	if (x.w == COMPLEX_ZERO || y.w == COMPLEX_ZERO)
+		return (COMPLEX_ZERO);
+
+	weight = Cmul(Conj(x.w), y.w);
+	if (var == 0)
+		return (weight);
+
+	x.w = COMPLEX_ONE;
+	y.w = COMPLEX_ONE;
+	k = x;
+	k.w = (uint64_t) var;	// var is encoded in the weight of the first key
+
+	r = CTlookup(k, y, innerProduct);
+	if (r.p != NULL)
+		return (Cmul(r.w, weight));
+
+	w = QMDDorder[var - 1];
+
+	sum = COMPLEX_ZERO;
+	for (i = 0; i < Nedge; i += Radix) {
+		if (!QMDDterminal(x) && x.p->v == w) {
+			e1 = x.p->e[i];
+		} else {
+			e1 = (i == 0) ? x : QMDDzero;
+		}
+		if (!QMDDterminal(y) && y.p->v == w) {
+			e2 = y.p->e[i];
+		} else {
+			e2 = (i == 0) ? y : QMDDzero;
+		}
+		sum = Cadd(sum, QMDDinnerProduct2(e1, e2, var - 1));
+	}
+
+	CTinsert(k, y, QMDDmakeTerminal(sum), innerProduct);
+	return (Cmul(sum, weight));
+}
+
+uint64_t QMDDinnerProduct(QMDDedge x, QMDDedge y)
+// returns the inner product <x|y> of the vectors pointed to by x and y
+		{
+	int var;
+
+	var = 0;
+	if (!QMDDterminal(x) && (QMDDinvorder[x.p->v] + 1) > var)
+		var = QMDDinvorder[x.p->v] + 1;
+	if (!QMDDterminal(y) && (QMDDinvorder[y.p->v] + 1) > var)
+		var = QMDDinvorder[y.p->v] + 1;
+
+	return (QMDDinnerProduct2(x, y, var));
+}
+
+mpreal QMDDfidelity(QMDDedge x, QMDDedge y)
+// returns the fidelity |<x|y>|^2 of the states pointed to by x and y
+		{
+	mpreal m = Cmag[QMDDinnerProduct(x, y) & 0x7FFFFFFF7FFFFFFFull];
+	return (m * m);
+}
+
+static QMDDedge QMDDcofactor2(QMDDedge a, int v, int op)
+// keeps the rows of the vector a in which variable v has value op (op = 0 or 1) and sets
+// all others to zero, or exchanges the rows with v = 0 and v = 1 (op = Radix)
+// results are memoized for the node (op and v are encoded in the second key of the compute table)
+		{
+	QMDDedge r, b, e[MAXNEDGE];
+	uint64_t weight;
+	int i;
+
+	if (a.w == COMPLEX_ZERO)
+		return (a);
+
+	if (QMDDterminal(a) || QMDDinvorder[a.p->v] < QMDDinvorder[v]) { // v does not occur below
+		if (op == Radix)
+			return (a);
+		for (i = 0; i < Nedge; i++)
+			e[i] = QMDDzero;
+		e[op * Radix] = a;
+		return (QMDDmakeNonterminal(v, e));
+	}
+
+	weight = a.w;
+	a.w = COMPLEX_ONE;
+	b.p = NULL;
+	b.w = (uint64_t) v * (Radix + 1) + op;
+
+	r = CTlookup(a, b, cofactor);
+	if (r.p != NULL) {
+		r.w = Cmul(r.w, weight);
+		return (r);
+	}
+
+	if (a.p->v == v) {
+		for (i = 0; i < Nedge; i++) {
+			if (op == Radix)
+				e[i] = a.p->e[((i / Radix + 1) % Radix) * Radix + i % Radix];
+			else
+				e[i] = (i / Radix == op) ? a.p->e[i] : QMDDzero;
+		}
+	} else {
+		for (i = 0; i < Nedge; i++)
+			e[i] = QMDDcofactor2(a.p->e[i], v, op);
+	}
+
+	r = QMDDmakeNonterminal(a.p->v, e);
+	CTinsert(a, b, r, cofactor);
+	r.w = Cmul(r.w, weight);
+	return (r);
+}
+
+QMDDedge QMDDrestrict(QMDDedge a, int v, int value)
+// returns the vector a with all amplitudes in which variable v does not have the given value set to zero
+// (the result is not renormalized)
+		{
+	return (QMDDcofactor2(a, v, value));
+}
+
+static QMDDedge QMDDrestrict2(QMDDedge a, int value[], int var, int low)
+// restricts the vector a to the values of value[] at the levels below var
+// (levels below low are not restricted, so a is returned as is there)
+// results are memoized for the node and the level (the compute table is emptied for every restriction)
+		{
+	QMDDedge r, b, e[MAXNEDGE];
+	uint64_t weight;
+	int i, w, skipped;
+
+	if (a.w == COMPLEX_ZERO || var <= low)
+		return (a);
+
+	w = QMDDorder[var - 1];
+	skipped = QMDDterminal(a) || a.p->v != w;
+	if (skipped && value[w] < 0)
+		return (QMDDrestrict2(a, value, var - 1, low));
+
+	weight = a.w;
+	a.w = COMPLEX_ONE;
+	b.p = NULL;
+	b.w = var;
+
+	r = CTlookup(a, b, restriction);
+	if (r.p != NULL) {
+		r.w = Cmul(r.w, weight);
+		return (r);
+	}
+
+	for (i = 0; i < Nedge; i++) {
+		if (value[w] >= 0 && i / Radix != value[w])
+			e[i] = QMDDzero;
+		else if (skipped)
+			e[i] = (i % Radix == 0) ? QMDDrestrict2(a, value, var - 1, low) : QMDDzero;
+		else
+			e[i] = QMDDrestrict2(a.p->e[i], value, var - 1, low);
+	}
+
+	r = QMDDmakeNonterminal(w, e);
+	CTinsert(a, b, r, restriction);
+	r.w = Cmul(r.w, weight);
+	return (r);
+}
+
+QMDDedge QMDDrestrict(QMDDedge a, int value[])
+// returns the vector a with all amplitudes set to zero in which some variable v does not have value[v]
+// (value[v] < 0 leaves variable v unrestricted; the result is not renormalized)
+		{
+	int var, low;
+
+	var = QMDDterminal(a) ? 0 : QMDDinvorder[a.p->v] + 1;
+	for (low = 0; low < var && value[QMDDorder[low]] < 0; low++)
+		;
+
+	CTable_restriction.clear();
+	return (QMDDrestrict2(a, value, var, low));
+}
+
+QMDDedge QMDDswapBranches(QMDDedge a, int v)
+// returns the vector a with the amplitudes for v = 0 and v = 1 exchanged (i.e., X applied to v)
+		{
+	return (QMDDcofactor2(a, v, Radix));
+}
+
+static QMDDedge QMDDsuccessor(QMDDedge a, int i, int skipped)
+// i-th successor of the vector a at the level of its top node (or at a level above that a skips),
+// with the weight of a applied
+		{
+	QMDDedge r;
+
+	if (a.w == COMPLEX_ZERO || (skipped && i % Radix != 0))
+		return (QMDDzero);
+	if (skipped)
+		return (a);
+	r = a.p->e[i];
+	r.w = Cmul(r.w, a.w);
+	if (r.w == COMPLEX_ZERO)
+		return (QMDDzero);
+	return (r);
+}
+
+static QMDDedge QMDDselect2(QMDDedge a, QMDDedge b, int line[], int var, int low)
+// returns the vector that agrees with b on the rows in which all controls of line[] at the levels
+// below var are satisfied and with a on all other rows
+// results are only memoized if a or b has its top node at level var-1, which determines var
+		{
+	QMDDedge r, e[MAXNEDGE];
+	int i, w, askipped, bskipped, memo;
+
+	if (var <= low)
+		return (b);
+	if (QMDDedgeEqual(a, b))
+		return (a);
+
+	w = QMDDorder[var - 1];
+	askipped = QMDDterminal(a) || a.p->v != w;
+	bskipped = QMDDterminal(b) || b.p->v != w;
+	if (askipped && bskipped && line[w] < 0)
+		return (QMDDselect2(a, b, line, var - 1, low));
+
+	memo = !askipped || !bskipped;
+	if (memo) {
+		r = CTlookup(a, b, permutation);
+		if (r.p != NULL)
+			return (r);
+	}
+
+	for (i = 0; i < Nedge; i++) {
+		if (line[w] >= 0 && i / Radix != line[w]) // control not satisfied
+			e[i] = QMDDsuccessor(a, i, askipped);
+		else
+			e[i] = QMDDselect2(QMDDsuccessor(a, i, askipped), QMDDsuccessor(b, i, bskipped), line, var - 1, low);
+	}
+
+	r = QMDDmakeNonterminal(w, e);
+	if (memo)
+		CTinsert(a, b, r, permutation);
+	return (r);
+}
+
+static QMDDedge QMDDpermute2(QMDDedge a, int line[], int var, int low)
+// applies the gate given by line[] to the levels below var of the vector a (see QMDDpermute)
+// results are memoized for the node and the level
+		{
+	QMDDedge r, b, e[MAXNEDGE];
+	uint64_t weight;
+	int i, w, skipped;
+
+	if (a.w == COMPLEX_ZERO || var <= low)
+		return (a);
+
+	w = QMDDorder[var - 1];
+	skipped = QMDDterminal(a) || a.p->v != w;
+	if (skipped && line[w] < 0)
+		return (QMDDpermute2(a, line, var - 1, low));
+
+	weight = a.w;
+	a.w = COMPLEX_ONE;
+	b.p = NULL;
+	b.w = var;
+
+	r = CTlookup(a, b, permutation);
+	if (r.p != NULL) {
+		r.w = Cmul(r.w, weight);
+		return (r);
+	}
+
+	for (i = 0; i < Nedge; i++) {
+		if (line[w] == Radix) // target: take the other row where the controls below are satisfied
+			e[i] = QMDDselect2(QMDDsuccessor(a, i, skipped),
+					QMDDsuccessor(a, ((i / Radix + 1) % Radix) * Radix + i % Radix, skipped), line, var - 1, low);
+		else if (line[w] >= 0 && i / Radix != line[w]) // control not satisfied
+			e[i] = QMDDsuccessor(a, i, skipped);
+		else
+			e[i] = QMDDpermute2(QMDDsuccessor(a, i, skipped), line, var - 1, low);
+	}
+
+	r = QMDDmakeNonterminal(w, e);
+	CTinsert(a, b, r, permutation);
+	r.w = Cmul(r.w, weight);
+	return (r);
+}
+
+QMDDedge QMDDpermute(QMDDedge a, int line[], int n)
+// returns the vector a (over the variables at levels 0..n-1) with an X gate applied to the target of
+// line[] under its controls (same encoding as for QMDDmvlgate), i.e., the rows are permuted by
+// rearranging the edges; unlike QMDDmultiply, no sub-diagrams are added
+		{
+	int low;
+
+	for (low = 0; low < n && line[QMDDorder[low]] < 0; low++)
+		;
+
+	CTable_permutation.clear();
+	return (QMDDpermute2(a, line, n, low));
+}
+
+static QMDDedge QMDDdiagonal2(QMDDedge a, int pos[], uint64_t d[], int k, int var, int bits, int fixed)
+// applies the diagonal d (see QMDDdiagonal) to the levels below var of the vector a; the bits of the
+// index into d given by fixed are already determined by the path to a (bits)
+// results are memoized for the node, the level and bits
+		{
+	QMDDedge r, b, e[MAXNEDGE];
+	uint64_t weight;
+	int i, w, x, skipped;
+
+	if (a.w == COMPLEX_ZERO)
+		return (a);
+
+	// all entries that can still be reached are equal: just scale a
+	weight = d[bits];
+	for (x = 0; x < (1 << k); x++) {
+		if ((x & fixed) == bits && d[x] != weight)
+			break;
+	}
+	if (x == (1 << k)) {
+		if (weight != COMPLEX_ONE)
+			a.w = Cmul(a.w, weight);
+		return (a);
+	}
+
+	w = QMDDorder[var - 1];
+	skipped = QMDDterminal(a) || a.p->v != w;
+	if (skipped && pos[w] < 0)
+		return (QMDDdiagonal2(a, pos, d, k, var - 1, bits, fixed));
+
+	weight = a.w;
+	a.w = COMPLEX_ONE;
+	b.p = NULL;
+	b.w = ((uint64_t) var << k) | bits;
+
+	r = CTlookup(a, b, diagonal);
+	if (r.p != NULL) {
+		r.w = Cmul(r.w, weight);
+		return (r);
+	}
+
+	for (i = 0; i < Nedge; i++) {
+		if (pos[w] < 0)
+			e[i] = QMDDdiagonal2(QMDDsuccessor(a, i, skipped), pos, d, k, var - 1, bits, fixed);
+		else
+			e[i] = QMDDdiagonal2(QMDDsuccessor(a, i, skipped), pos, d, k, var - 1,
+					bits | ((i / Radix) << pos[w]), fixed | (1 << pos[w]));
+	}
+
+	r = QMDDmakeNonterminal(w, e);
+	CTinsert(a, b, r, diagonal);
+	r.w = Cmul(r.w, weight);
+	return (r);
+}
+
+QMDDedge QMDDdiagonal(QMDDedge a, int pos[], uint64_t d[], int k, int n)
+// returns the vector a (over the variables at levels 0..n-1) multiplied by a diagonal matrix on k
+// variables: pos[v] is the bit of variable v in the index into d (-1 if v is not affected) and
+// d[x] the entry for index x; only edge weights are multiplied, subdiagrams in which all remaining
+// entries agree are scaled as a whole
+// d[0] is factored out (as for a normalized gate), such that branches with the same entry keep their
+// weights
+		{
+	std::vector<uint64_t> rel(1 << k);
+	QMDDedge r;
+	int x;
+
+	for (x = 0; x < (1 << k); x++)
+		rel[x] = Cdiv(d[x], d[0]);
+
+	CTable_diagonal.clear();
+	r = QMDDdiagonal2(a, pos, rel.data(), k, n, 0, 0);
+	r.w = Cmul(r.w, d[0]);
+	return (r);
+}
+
 QMDDedge QMDDtrace(QMDDedge a, unsigned char var, char remove[], char all)
 // compute the trace or partial trace of the matrix represented by the QMDD with top edge a
 // returns an edge pointing to the QMDD representing the result
@@ -2065,7 +2564,7 @@ int QMDDsize(QMDDedge e)
 void QMDDstatistics(void)
 // displays QMDD package statistics
 		{
-	printf("\nCurrent # nodes in unique tables: %ld\n\n", QMDDnodecount);
+	printf("\nCurrent # nodes in unique tables: %ld\n\n", (int64_t) QMDDnodecount);
 	printf("Total compute table lookups: %ld\n",
 			CTlook[0] + CTlook[1] + CTlook[2]);
 	printf("Number of ops: adds %ld mults %ld Kronecker %ld\n", Nop[add],
@@ -65,6 +65,7 @@ by citing the following publication:
 #include <stdlib.h>
 #include <string.h>
 #include <unordered_map>
+#include <atomic>
 
 #include <cstdint>
 //#include <stdint.h>
@@ -90,11 +91,18 @@ typedef struct QMDDedge
 typedef struct QMDDnode
 {
    QMDDnodeptr next;  // link for unique table and available space chain 
+   QMDDnodeptr levelNext;  // link for the list of all nodes of the variable in the unique table (UniqueNodes)
    unsigned int ref;  // reference count 												 
    unsigned char v;   // variable index (nonterminal) value (-1 for terminal)
    uint64_t renormFactor; // factor that records renormalization factor
    char ident,diag,block,symm,c01;        // flag to mark if vertex heads a QMDD for a special matrix
    char computeSpecialMatricesFlag;	  // flag to mark whether SpecialMatrices are to be computed
+   unsigned int scratchEpoch;	  // traversal in which the scratch slots were last written (see QMDDscratchBegin)
+   union {
+      double scratch[2];		  // per-node scratch slots for memoizing single-threaded traversals,
+      QMDDedge scratchEdge;	  // used as two numbers, as an edge (e.g., a memoized result)
+      size_t scratchIndex;	  // or as an index into a side array of the traversal
+   };
    //QMDDedge e[0]; 	  	// edges out of this node - variable so must be last in structure 
    QMDDedge e[MAXNEDGE];	// when calling malloc in QMDDgetnode
 }  QMDDnode;
@@ -112,7 +120,7 @@ typedef struct ListElement
 
 // computed table definitions 
 
-typedef enum{add,mult,kronecker,reduce,transpose,conjugateTranspose,transform,c0,c1,c2,none,norm,createHdmSign,findCmnSign,findBin,reduceHdm, renormalize} CTkind; // compute table entry kinds 
+typedef enum{add,mult,kronecker,reduce,transpose,conjugateTranspose,transform,c0,c1,c2,none,norm,createHdmSign,findCmnSign,findBin,reduceHdm, renormalize, innerProduct, cofactor, restriction, exchange, permutation, diagonal} CTkind; // compute table entry kinds 
 
 typedef struct CTentry// computed table entry defn 										 
 {			
@@ -181,19 +189,20 @@ EXTERN QMDDedge QMDDone,QMDDzero; 	// edges pointing to zero and one QMDD consta
 EXTERN int64_t QMDDorder[MAXN];		// variable order initially 0,1,... from bottom up | Usage: QMDDorder[level] := varible at a certain level
 EXTERN int64_t QMDDinvorder[MAXN];	// inverse of variable order (inverse permutation) | Usage: QMDDinvorder[variable] := level of a certain variable
 
-EXTERN int64_t QMDDnodecount;			// counts active nodes
-EXTERN int64_t QMDDpeaknodecount;                 // records peak node count in unique table
+EXTERN std::atomic<int64_t> QMDDnodecount;			// counts active nodes
+EXTERN std::atomic<int64_t> QMDDpeaknodecount;                 // records peak node count in unique table
 
 EXTERN int64_t Ncount;				// used in QMDD node count - very naive approach
 EXTERN QMDDnodeptr Nlist[MAXNODECOUNT];
 
 EXTERN int64_t Nop[6];				// operation counters
 
-EXTERN int64_t CTlook[20],CThit[20];	// counters for gathering compute table hit stats
+EXTERN int64_t CTlook[diagonal + 1],CThit[diagonal + 1];	// counters for gathering compute table hit stats
 
 EXTERN int64_t UTcol, UTmatch, UTlookups;			// counter for collisions / matches in hash tables
 EXTERN int64_t UTkeys[NBUCKET];
 
+EXTERN unsigned int QMDDscratchEpoch;	// current traversal for the scratch slots of the nodes
 EXTERN int GCcurrentLimit;			// current garbage collection limit 
 
 EXTERN int ActiveNodeCount;		// number of active nodes 
@@ -226,13 +235,28 @@ EXTERN int dynamicReorderingTreshold;
 
 EXTERN int largestRefCount;
 #endif
+
+// for parallel sampling (see QMDDparallelFor)
+#ifndef DEFINE_VARIABLES
+EXTERN int QMDDthreads;			// number of threads of the thread pool (1 = sequential)
+#endif
+EXTERN bool QMDDconcurrent;		// set while several threads create nodes (the unique table statistics are not updated)
 /*******************************************
 
 	Unique Tables (one per input variable)
+
+	lookups are lock-free, new nodes are inserted by a CAS on the
+	bucket head (see QMDDutLookup); nodes are only removed from the
+	chains while no other thread operates on the package
+
+	in addition, all nodes of a variable are linked in a list (by
+	levelNext), such that a level can be processed without scanning
+	its buckets
 	
 *******************************************/
 
-EXTERN QMDDnodeptr Unique[MAXN][NBUCKET];
+EXTERN std::atomic<QMDDnodeptr> Unique[MAXN][NBUCKET];
+EXTERN std::atomic<QMDDnodeptr> UniqueNodes[MAXN];
 
 /****************************************************
 
@@ -264,7 +288,7 @@ struct computeHasher
   }
 };
 
-EXTERN std::unordered_map< computeKey, QMDDedge, computeHasher > CTable_add, CTable_mult, CTable_transpose, CTable_conjugateTranspose, CTable_renormalize;
+EXTERN std::unordered_map< computeKey, QMDDedge, computeHasher > CTable_add, CTable_mult, CTable_transpose, CTable_conjugateTranspose, CTable_renormalize, CTable_innerProduct, CTable_cofactor, CTable_restriction, CTable_exchange, CTable_permutation, CTable_diagonal;
 
 
 /****************************************************
@@ -322,6 +346,9 @@ int dynamicReorderingTreshold = DYNREORDERLIMIT;
 
 int largestRefCount = 0;
 
+// for parallel sampling (see QMDDparallelFor)
+int QMDDthreads = 1;			// number of threads of the thread pool (1 = sequential)
+
 #else
 
 
@@ -342,6 +369,10 @@ int largestRefCount = 0;
 
 #define QMDDedgeEqual(a,b) ((a.p==b.p)&&(a.w==b.w)) // checks if two edges are equal
 
+// scratch slots of a node are valid iff they were written since the last call of QMDDscratchBegin()
+#define QMDDscratchValid(p) ((p)->scratchEpoch==QMDDscratchEpoch)
+#define QMDDscratchMark(p) ((p)->scratchEpoch=QMDDscratchEpoch)
+
 
 
 
@@ -376,6 +407,11 @@ QMDDedge CTlookup(QMDDedge,QMDDedge,CTkind);
 void CTinsert(QMDDedge,QMDDedge,QMDDedge,CTkind);
 void QMDDinitComputeTable(void);
 QMDDedge QMDDutLookup(QMDDedge);
+intptr_t QMDDutKey(QMDDnodeptr p);
+void QMDDutInsert(QMDDnodeptr p);
+void QMDDutRelease(QMDDnodeptr p);
+QMDDnodeptr QMDDgetNode(void);
+void QMDDreturnLocalNodes(void);
 QMDDedge QMDDmakeNonterminal(short,QMDDedge[]);
 //QMDDedge QMDDmakeTerminal(complex);
 QMDDedge QMDDmakeTerminal(uint64_t);
@@ -384,5 +420,13 @@ void QMDDdotExport(QMDDedge basic, int n, char outputFilename[], QMDDrevlibDescr
 void QMDDstatistics(void);
 QMDDedge QMDDconjugateTranspose(QMDDedge a);
 QMDDedge QMDDtrace(QMDDedge a, unsigned char var, char remove[], char all);
+uint64_t QMDDinnerProduct(QMDDedge x, QMDDedge y);
+mpreal QMDDfidelity(QMDDedge x, QMDDedge y);
+void QMDDscratchBegin(void);
+QMDDedge QMDDrestrict(QMDDedge a, int v, int value);
+QMDDedge QMDDrestrict(QMDDedge a, int value[]);
+QMDDedge QMDDswapBranches(QMDDedge a, int v);
+QMDDedge QMDDpermute(QMDDedge a, int line[], int n);
+QMDDedge QMDDdiagonal(QMDDedge a, int pos[], uint64_t d[], int k, int n);
 void QMDDprintActive(int n);
 #endif
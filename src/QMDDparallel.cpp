@@ -0,0 +1,175 @@
+/*
+DD-based simulator by JKU Linz, Austria
+
+Developer: Alwin Zulehner, Robert Wille
+
+With code from the QMDD implementation provided by Michael Miller (University of Victoria, Canada)
+and Philipp Niemann (University of Bremen, Germany).
+
+For more information, please visit http://iic.jku.at/eda/research/quantum_simulation
+
+If you have any questions feel free to contact us using
+alwin.zulehner@jku.at or robert.wille@jku.at
+
+If you use the quantum simulator for your research, we would be thankful if you referred to it
+by citing the following publication:
+
+@article{zulehner2018simulation,
+    title={Advanced Simulation of Quantum Computations},
+    author={Zulehner, Alwin and Wille, Robert},
+    journal={IEEE Transactions on Computer Aided Design of Integrated Circuits and Systems (TCAD)},
+    year={2018},
+    eprint = {arXiv:1707.00865}
+}
+*/
+
+#include "QMDDparallel.h"
+
+static QMDDthreadPool* pool = NULL;	// created by QMDDinitThreads if more than one thread is requested
+static thread_local int workerId = 0;	// index of the deque owned by the current thread
+
+/**************************************
+
+    Thread pool
+    
+**************************************/
+
+QMDDthreadPool::QMDDthreadPool(int threads) : stop(false), queued(0) {
+	if(threads < 1) {
+		threads = 1;
+	}
+	for(int i = 0; i < threads; i++) {
+		deques.push_back(std::unique_ptr<TaskDeque>(new TaskDeque()));
+	}
+	for(int i = 1; i < threads; i++) {
+		workers.push_back(std::thread(&QMDDthreadPool::WorkerLoop, this, i));
+	}
+}
+
+QMDDthreadPool::~QMDDthreadPool() {
+	stop = true;
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+	}
+	wake.notify_all();
+	for(std::thread& t : workers) {
+		t.join();
+	}
+}
+
+void QMDDthreadPool::Spawn(QMDDtask* task) {
+	TaskDeque& d = *deques[workerId];
+	{
+		std::lock_guard<std::mutex> lock(d.m);
+		d.tasks.push_back(task);
+	}
+	queued++;
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+	}
+	wake.notify_one();
+}
+
+void QMDDthreadPool::Wait(QMDDtask* task) {
+	while(!task->done.load(std::memory_order_acquire)) {
+		if(!RunOne(workerId)) {
+			std::this_thread::yield();
+		}
+	}
+}
+
+bool QMDDthreadPool::RunOne(int self) {
+	QMDDtask* task = NULL;
+	int n = (int) deques.size();
+
+	{
+		TaskDeque& d = *deques[self];
+		std::lock_guard<std::mutex> lock(d.m);
+		if(!d.tasks.empty()) {
+			task = d.tasks.back();
+			d.tasks.pop_back();
+		}
+	}
+	for(int k = 1; task == NULL && k < n; k++) {
+		TaskDeque& d = *deques[(self + k) % n];
+		std::lock_guard<std::mutex> lock(d.m);
+		if(!d.tasks.empty()) {
+			task = d.tasks.front();
+			d.tasks.pop_front();
+		}
+	}
+	if(task == NULL) {
+		return false;
+	}
+	queued--;
+	task->Run();
+	task->done.store(true, std::memory_order_release);
+	return true;
+}
+
+void QMDDthreadPool::WorkerLoop(int id) {
+	workerId = id;
+	while(!stop) {
+		if(!RunOne(id)) {
+			std::unique_lock<std::mutex> lock(sleepMutex);
+			wake.wait(lock, [this] { return stop || queued > 0; });
+		}
+	}
+}
+
+/**************************************
+
+    Public routines
+    
+**************************************/
+
+void QMDDinitThreads(int threads)
+// set up the worker threads used by QMDDparallelFor
+{
+	QMDDshutdownThreads();
+
+	QMDDthreads = threads < 1 ? 1 : threads;
+	if (QMDDthreads > 1) {
+		pool = new QMDDthreadPool(QMDDthreads);
+	}
+}
+
+void QMDDshutdownThreads(void)
+// stop the worker threads (QMDDparallelFor falls back to sequential mode)
+{
+	delete pool;	// the exiting workers return their available space chains
+	pool = NULL;
+	QMDDthreads = 1;
+	QMDDreturnLocalNodes();
+}
+
+class QMDDforTask : public QMDDtask {
+public:
+	QMDDforTask(const std::function<void(int)>& body, int i) : body(body), i(i) {}
+	void Run() {
+		body(i);
+	}
+
+private:
+	const std::function<void(int)>& body;
+	int i;
+};
+
+void QMDDparallelFor(int n, const std::function<void(int)>& body)
+// run body(0), ..., body(n-1) on the thread pool (sequentially if there is none)
+// body must not create or modify QMDD nodes
+{
+	if (pool == NULL) {
+		for (int i = 0; i < n; i++)
+			body(i);
+		return;
+	}
+
+	std::vector<std::unique_ptr<QMDDforTask> > tasks;
+	for (int i = 0; i < n; i++) {
+		tasks.emplace_back(new QMDDforTask(body, i));
+		pool->Spawn(tasks.back().get());
+	}
+	for (int i = 0; i < n; i++)
+		pool->Wait(tasks[i].get());
+}
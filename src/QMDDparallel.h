@@ -0,0 +1,97 @@
+/*
+DD-based simulator by JKU Linz, Austria
+
+Developer: Alwin Zulehner, Robert Wille
+
+With code from the QMDD implementation provided by Michael Miller (University of Victoria, Canada)
+and Philipp Niemann (University of Bremen, Germany).
+
+For more information, please visit http://iic.jku.at/eda/research/quantum_simulation
+
+If you have any questions feel free to contact us using
+alwin.zulehner@jku.at or robert.wille@jku.at
+
+If you use the quantum simulator for your research, we would be thankful if you referred to it
+by citing the following publication:
+
+@article{zulehner2018simulation,
+    title={Advanced Simulation of Quantum Computations},
+    author={Zulehner, Alwin and Wille, Robert},
+    journal={IEEE Transactions on Computer Aided Design of Integrated Circuits and Systems (TCAD)},
+    year={2018},
+    eprint = {arXiv:1707.00865}
+}
+*/
+
+#ifndef QMDDparallel_H
+#define QMDDparallel_H
+
+#include "QMDDpackage.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*****************************************************************
+
+    Work-stealing thread pool used for parallel sampling
+
+    Every thread (the main thread has id 0) owns a deque of tasks.
+    New tasks are pushed to the back of the own deque and taken
+    from there again (LIFO), idle threads steal from the front of
+    the other deques (FIFO). A thread waiting for a task executes
+    other tasks in the meantime, i.e. nested fork/join is deadlock free.
+
+*****************************************************************/
+
+class QMDDtask {
+public:
+	QMDDtask() : done(false) {}
+	virtual ~QMDDtask() {}
+	virtual void Run() = 0;
+
+	std::atomic<bool> done;
+};
+
+class QMDDthreadPool {
+public:
+	explicit QMDDthreadPool(int threads);
+	~QMDDthreadPool();
+
+	void Spawn(QMDDtask* task);
+	void Wait(QMDDtask* task);
+	int Size() {
+		return (int) deques.size();
+	}
+
+private:
+	struct TaskDeque {
+		std::mutex m;
+		std::deque<QMDDtask*> tasks;
+	};
+
+	bool RunOne(int self);
+	void WorkerLoop(int id);
+
+	std::vector<std::unique_ptr<TaskDeque> > deques;
+	std::vector<std::thread> workers;
+	std::atomic<bool> stop;
+	std::atomic<int> queued;
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+};
+
+/*****************************************************************
+
+    Routines
+*****************************************************************/
+
+void QMDDinitThreads(int threads);
+void QMDDshutdownThreads(void);
+void QMDDparallelFor(int n, const std::function<void(int)>& body);
+
+#endif
@@ -350,13 +350,51 @@ for(i=0;i<Nedge;i++) // no longer count references from v1-vertex
   }
 }
 
+static int QMDDreleaseInactive(int v)
+// removes the inactive nodes of variable v from the unique table and places them on the
+// available space chain; returns the number of released nodes
+{
+  QMDDnodeptr p, pnext, plast, q;
+  intptr_t key;
+  int count=0;
+
+  plast=NULL;  // node just before p in the list of variable v
+  for(p=UniqueNodes[v];p!=NULL;p=pnext)
+  {
+    pnext=p->levelNext;
+    if(p->ref!=0) {
+      plast=p;
+      continue;
+    }
+    if(plast==NULL)
+      UniqueNodes[v]=pnext;
+    else
+      plast->levelNext=pnext;
+
+    key=QMDDutKey(p);
+    if(Unique[v][key]==p)
+      Unique[v][key]=p->next;
+    else {
+      for(q=Unique[v][key];q->next!=p;q=q->next);
+      q->next=p->next;
+    }
+    QMDDutRelease(p);
+    count++;
+  }
+  return count;
+}
+
 void QMDDswap(int i)
 // swap variables at positions i and i-1 in the variable order
 // note variable positions are numbered 0,1,2,... from bottom of QMDD
+// only the nodes of the two variables are visited (see UniqueNodes); inactive
+// nodes of both variables are released on the way
+// nodes are changed in place, so their new normalization is kept in renormFactor, which only
+// QMDDsift/SJTalgorithm take into account (the simulator reorders with QMDDexchange instead)
 
 {
-  int t,v1,v2;
-  QMDDnodeptr table[NBUCKET],p,pnext,ptemp, plast;
+  int t,v1,v2,released;
+  QMDDnodeptr list,active,p,pnext;
   char tempLab[MAXSTRLEN]; 
   
   v1=QMDDorder[i];
@@ -377,63 +415,42 @@ void QMDDswap(int i)
   strcpy(tempLab,Label[i]);
   strcpy(Label[i],Label[i-1]);
   strcpy(Label[i-1],tempLab);
-// copy unique table for variable v1 and empty source
-  for(t=0;t<NBUCKET;t++)
-  {
-    table[t]=Unique[v1][t];
-    Unique[v1][t]=NULL;
-  }
+// take all nodes of variable v1 out of the unique table (every non-empty bucket holds one of them)
+  list=UniqueNodes[v1];
+  UniqueNodes[v1]=NULL;
+  for(p=list;p!=NULL;p=p->levelNext)
+    Unique[v1][QMDDutKey(p)]=NULL;
   
 // process nodes one at a time
 
-/// FIRST RUN: check for don't care nodes and insert them immediately
-  for(t=0;t<NBUCKET;t++)
+/// FIRST RUN: release inactive nodes, check for don't care nodes and insert them immediately
+  released=0;
+  active=NULL;
+  for(p=list;p!=NULL;p=pnext)
   {
-    p=table[t];
-    plast=NULL;  // pointing to the node just before p in the table-collision-chain
-    while(p!=NULL)
-    {
-      pnext=p->next;
-      if(p->ref!=0) {
-	//printf("found node at slot %d. node %d\n", t, (intptr_t) p);
-	if(QMDDcheckDontCare(p,v2)) { // is active don't care, so immediately put it back to Unique table
-	  //printf("Debug: found don't care node  %d (does not point to %d) and reinsert it!\n", (intptr_t) p, v2);
-         //printf("DC");
-	//***** putting node to the front of the Unique table collision chain *****//
-	ptemp=Unique[v1][t];
-	Unique[v1][t] = p;
-	p->next = ptemp;
-	
-	//***** and delete from table[] *******************************************//
-	if (plast == NULL) // p was the first entry in the collision chain
-	  table[t] = pnext;
-	else
-	  plast->next = pnext;
-        } else {
-	  // if not a dont-care-node, don't forget to readjust the plast pointer
-	 plast = p;  // ALERT: very important!
-	}
-      }
-      p=pnext;
+    pnext=p->levelNext;
+    if(p->ref==0) {
+      QMDDutRelease(p);
+      released++;
+    } else if(QMDDcheckDontCare(p,v2)) { // is active don't care, so immediately put it back to Unique table
+      QMDDutInsert(p);
+    } else {
+      p->levelNext=active;
+      active=p;
     }
   }
 
-/// SECOND RUN: modify remaining active nodes
-for(t=0;t<NBUCKET;t++)
+/// SECOND RUN: modify remaining active nodes (they are inserted for v2 by QMDDchangeNonterminal)
+  for(p=active;p!=NULL;p=pnext)
   {
-    p=table[t];
-    while(p!=NULL)
-    {
-      pnext=p->next;
-      if(p->ref!=0) QMDDswapNode(p,v1,v2, i);
-      else {
-	// remove inactive node and mark as available
-        //p->next=Avail; // WARNING: potentially buggy ;-)
-        //Avail=p;
-      }
-      p=pnext;
-    }
+    pnext=p->levelNext;
+    QMDDswapNode(p,v1,v2, i);
   }
+
+/// THIRD RUN: release the nodes of v2 that are no longer referenced
+  released+=QMDDreleaseInactive(v2);
+  if(released)
+    QMDDinitComputeTable(); // compute table entries may refer to released nodes
   return;
 }
 
@@ -872,7 +889,7 @@ void QMDDreorder(int order[],int n, QMDDedge *root)
       //printf(" %d ",j);
       QMDDswap(j);}
 #if DEBUG_REORDER
-   printf("Active Nodes: %d, Nodes: %d\n", ActiveNodeCount, QMDDnodecount);
+   printf("Active Nodes: %d, Nodes: %ld\n", ActiveNodeCount, (int64_t) QMDDnodecount);
 #endif
    if(GCswitch) {
     	QMDDgarbageCollect();
@@ -916,6 +933,311 @@ void QMDDreorder(int order[],int n, QMDDedge *root)
 
 
 
+void QMDDresetOrder(void)
+// restores the initial variable order 0,1,... from the bottom
+// must only be called if no node is active; all inactive nodes are released
+{
+  int i, j, identity = 1;
+  QMDDnodeptr p, pnext;
+
+  for(i=0;i<MAXN;i++)
+    if(QMDDorder[i]!=i) identity = 0;
+  if(identity) return;
+
+  for(i=0;i<MAXN;i++)
+    UniqueNodes[i]=NULL;
+  for(i=0;i<MAXN;i++)
+    for(j=0;j<NBUCKET;j++)
+    {
+      p=Unique[i][j];
+      Unique[i][j]=NULL;
+      while(p!=NULL)
+      {
+        if(p->ref!=0) {
+          printf("ERROR: cannot reset the variable order while nodes are active!\n");
+          exit(1);
+        }
+        pnext=p->next;
+        p->next=Avail;
+        Avail=p;
+        p=pnext;
+      }
+    }
+  QMDDnodecount=0;
+
+  for(i=0;i<MAXN;i++)
+  {
+    QMDDorder[i]=QMDDinvorder[i]=i;
+    Active[i]=0;
+  }
+  QMDDinitComputeTable();
+}
+
+static QMDDedge QMDDexchange2(QMDDedge a, int i)
+// rebuilds a for the variable order in which positions i and i-1 are exchanged
+// nodes below position i are not affected and returned as they are
+{
+  QMDDedge r, c, table[MAXNEDGE][MAXNEDGE], e[MAXNEDGE];
+  uint64_t weight;
+  int j, k, y;
+
+  if(a.w==COMPLEX_ZERO || QMDDterminal(a) || QMDDinvorder[a.p->v]<i)
+    return(a);
+
+  weight=a.w;
+  a.w=COMPLEX_ONE;
+
+  r=CTlookup(a,a,exchange);
+  if(r.p!=NULL)
+  {
+    r.w=Cmul(r.w,weight);
+    return(r);
+  }
+
+  if(QMDDinvorder[a.p->v]>i)
+  {
+    for(k=0;k<Nedge;k++)
+      e[k]=QMDDexchange2(a.p->e[k],i);
+    r=QMDDmakeNonterminal(a.p->v,e);
+  }
+  else
+  {
+    // same transposition as in QMDDswapNode, but new nodes are built instead of changing a in place
+    y=QMDDorder[i-1];
+    for(k=0;k<Nedge;k++)
+    {
+      c=a.p->e[k];
+      for(j=0;j<Nedge;j++)
+      {
+        if(QMDDterminal(c)||c.p->v!=y)   // edge skips variable y
+          table[j][k]=c;
+        else
+        {
+          table[j][k]=c.p->e[j];
+          table[j][k].w=Cmul(table[j][k].w,c.w);
+          if(table[j][k].w==COMPLEX_ZERO)
+            table[j][k]=QMDDzero;
+        }
+      }
+    }
+    for(j=0;j<Nedge;j++)
+      e[j]=QMDDmakeNonterminal(a.p->v,table[j]);
+    r=QMDDmakeNonterminal(y,e);
+  }
+
+  CTinsert(a,a,r,exchange);
+  r.w=Cmul(r.w,weight);
+  return(r);
+}
+
+QMDDedge QMDDexchange(QMDDedge a, int i)
+// returns a for the variable order with the variables at positions i and i-1 exchanged
+// and updates QMDDorder/QMDDinvorder accordingly; other active QMDDs are not adapted and
+// become invalid (unlike QMDDswap no renormalization factors are involved)
+{
+  QMDDedge r;
+  int t;
+
+  CTable_exchange.clear();
+  r=QMDDexchange2(a,i);
+
+  t=QMDDorder[i];
+  QMDDorder[i]=QMDDorder[i-1];
+  QMDDorder[i-1]=t;
+  QMDDinvorder[QMDDorder[i]]=i;
+  QMDDinvorder[QMDDorder[i-1]]=i-1;
+  return(r);
+}
+
+static void QMDDexchangeRoot(QMDDedge *root, int i)
+// replaces *root by its QMDD for positions i and i-1 exchanged
+// the old nodes are released level by level (see UniqueNodes) from position i-1 up, as the QMDD
+// below is not changed, instead of scanning the whole unique table by QMDDgarbageCollect
+{
+  QMDDedge e;
+  int j, top=i;
+
+  if(!QMDDterminal((*root))&&QMDDinvorder[root->p->v]>top)
+    top=QMDDinvorder[root->p->v];
+  e=QMDDexchange(*root,i);
+  QMDDincref(e);
+  QMDDdecref(*root);
+  *root=e;
+  for(j=i-1;j<=top;j++)
+    QMDDreleaseInactive(QMDDorder[j]);
+  CTable_transpose.clear();	// used by QMDDcheckSpecialMatrices, may refer to released nodes
+}
+
+int QMDDsiftExchange(int n, QMDDedge *root)
+// sifting on variables at positions 0..n-1 of the QMDD *root (which has to be the only active QMDD)
+// based on QMDDexchange; a variable is moved to the end of the order that is nearer first and no
+// further in a direction once the QMDD has grown to more than twice its smallest size
+// returns the number of active nodes afterwards
+{
+  char free[MAXN];
+  int i, j, v, pos, start, best, bestpos, cost, max;
+
+  for(i=0;i<n;i++)
+    free[i]=1;
+
+  for(i=0;i<n;i++)
+  {
+    v=-1;
+    max=-1;
+    for(j=0;j<n;j++)		// choose the widest untouched variable
+      if(free[QMDDorder[j]]&&Active[QMDDorder[j]]>max)
+      {
+        v=QMDDorder[j];
+        max=Active[v];
+      }
+    free[v]=0;
+
+    start=pos=bestpos=QMDDinvorder[v];
+    best=ActiveNodeCount;
+
+    if(start<n-1-start)
+    {
+      while(pos>0)
+      {
+        QMDDexchangeRoot(root,pos--);
+        if((cost=ActiveNodeCount)<best) { best=cost; bestpos=pos; }
+        if(cost>2*best) break;
+      }
+      while(pos<n-1)
+      {
+        QMDDexchangeRoot(root,++pos);
+        if((cost=ActiveNodeCount)<best) { best=cost; bestpos=pos; }
+        if(cost>2*best&&pos>start) break;
+      }
+    }
+    else
+    {
+      while(pos<n-1)
+      {
+        QMDDexchangeRoot(root,++pos);
+        if((cost=ActiveNodeCount)<best) { best=cost; bestpos=pos; }
+        if(cost>2*best) break;
+      }
+      while(pos>0)
+      {
+        QMDDexchangeRoot(root,pos--);
+        if((cost=ActiveNodeCount)<best) { best=cost; bestpos=pos; }
+        if(cost>2*best&&pos<start) break;
+      }
+    }
+
+    while(pos<bestpos)		// move back to the best position
+      QMDDexchangeRoot(root,++pos);
+    while(pos>bestpos)
+      QMDDexchangeRoot(root,pos--);
+  }
+
+  QMDDinitComputeTable();	// identity matrices cached for the old order are invalid now
+  return(ActiveNodeCount);
+}
+
+#define MAXWINDOW 4		// max no. of levels permuted by QMDDwindowPermute
+#define MAXWINDOWPASSES 8	// max no. of passes of QMDDwindowPermute
+
+static int QMDDwindowSwaps(int k, int swaps[])
+// positions (1..k-1 within the window) of the adjacent exchanges that run through all k!
+// permutations of a window of k levels (Steinhaus-Johnson-Trotter)
+// returns the number of exchanges, i.e., k!-1
+{
+  int perm[MAXWINDOW], dir[MAXWINDOW], i, m, t, s=0;
+
+  for(i=0;i<k;i++)
+  {
+    perm[i]=i;
+    dir[i]=-1;
+  }
+
+  for(;;)
+  {
+    m=-1;			// position of the largest mobile element
+    for(i=0;i<k;i++)
+      if(i+dir[perm[i]]>=0&&i+dir[perm[i]]<k&&perm[i+dir[perm[i]]]<perm[i]&&(m<0||perm[i]>perm[m]))
+        m=i;
+    if(m<0)
+      return(s);
+
+    t=perm[m];
+    i=m+dir[t];
+    perm[m]=perm[i];
+    perm[i]=t;
+    swaps[s++]=m>i?m:i;
+
+    for(i=0;i<k;i++)
+      if(perm[i]>t)
+        dir[perm[i]]=-dir[perm[i]];
+  }
+}
+
+int QMDDwindowPermute(int n, QMDDedge *root, int k, double budget)
+// window permutation on variables at positions 0..n-1 of the QMDD *root (which has to be the only
+// active QMDD): all orders of k (2..4) adjacent levels are tried and the best one according to
+// siftingCostFunction is kept; the window slides bottom up and another pass (up to MAXWINDOWPASSES)
+// is started only if the cost at the end of a pass is below the cost at its start, but no new window
+// is started once budget seconds (if > 0) are used up
+// returns the number of active nodes afterwards
+{
+  int swaps[24], bestorder[MAXWINDOW];
+  int i, j, w, s, nswaps, cost, best, pass, passcost, expired=0;
+  long start=cpuTime();
+
+  if(k>MAXWINDOW)
+    k=MAXWINDOW;
+  if(k>n)
+    k=n;
+  if(k<2)
+    return(ActiveNodeCount);
+  nswaps=QMDDwindowSwaps(k,swaps);
+
+  cost=siftingCostFunction(*root);
+  for(pass=0;pass<MAXWINDOWPASSES&&!expired;pass++)
+  {
+    passcost=cost;
+    for(w=0;w+k<=n;w++)
+    {
+      if(budget>0&&(double)(cpuTime()-start)/CLOCKS_PER_SEC>budget)
+      {
+        expired=1;
+        break;
+      }
+
+      best=siftingCostFunction(*root);
+      for(j=0;j<k;j++)
+        bestorder[j]=QMDDorder[w+j];
+
+      for(s=0;s<nswaps;s++)
+      {
+        QMDDexchangeRoot(root,w+swaps[s]);
+        if((cost=siftingCostFunction(*root))<best)
+        {
+          best=cost;
+          for(j=0;j<k;j++)
+            bestorder[j]=QMDDorder[w+j];
+        }
+      }
+
+      for(j=0;j<k;j++)		// bubble the window into the best order
+      {
+        for(i=w+j;QMDDorder[i]!=bestorder[j];i++);
+        for(;i>w+j;i--)
+          QMDDexchangeRoot(root,i);
+      }
+      if (DEBUG_REORDER) printf("window %d (pass %d): %d active nodes\n", w, pass, ActiveNodeCount);
+    }
+
+    if((cost=siftingCostFunction(*root))>=passcost)	// e.g., alternating between two orders
+      break;
+  }
+
+  QMDDinitComputeTable();	// identity matrices cached for the old order are invalid now
+  return(ActiveNodeCount);
+}
+
+
 typedef enum{TOP, BOTTOM, UP, DOWN} moveType; // move variable kinds 
 
 
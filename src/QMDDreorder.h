@@ -60,6 +60,10 @@ int myQMDDsift(int n, QMDDedge *root, QMDDrevlibDescription *circ, std::ostream
 int QMDDsift(int n, QMDDedge *root, QMDDrevlibDescription *circ);
 int lookupLabel(char buffer[], char moveLabel[], QMDDrevlibDescription *circ);
 void QMDDreorder(int order[],int n, QMDDedge *root);
+void QMDDresetOrder(void);
+QMDDedge QMDDexchange(QMDDedge a, int i);
+int QMDDsiftExchange(int n, QMDDedge *root);
+int QMDDwindowPermute(int n, QMDDedge *root, int k, double budget);
 void myQMDDreorder(int order[],int n, QMDDedge *root);
 int QMDDmoveVariable(QMDDedge *basic, char buffer[], QMDDrevlibDescription *circ);
 void SJTalgorithm(QMDDedge a, int n);
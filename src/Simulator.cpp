@@ -24,12 +24,18 @@ by citing the following publication:
 */
 
 #include <Simulator.h>
+#include <algorithm>
+#include <QMDDparallel.h>
+#include <QMDDreorder.h>
+#include <chrono>
+#include <random>
 
 Simulator::Simulator() {
 	// TODO Auto-generated constructor stub
 	epsilon = mpreal(0.01);
 	for(int i = 0; i < MAXN; i++) {
 		line[i] = -1;
+		qubit_var[i] = i;
 	}
 	circ.e = QMDDone;
 	QMDDincref(circ.e);
@@ -44,8 +50,19 @@ Simulator::~Simulator() {
 
 void Simulator::Reset() {
 	QMDDdecref(circ.e);
+	for(auto it = retained_states.begin(); it != retained_states.end(); it++) {
+		QMDDdecref(*it);
+	}
+	retained_states.clear();
+	QMDDdecref(beforeMeasurement);
 	QMDDgarbageCollect();
-	cleanCtable(std::vector<QMDDedge>());
+	CleanComplexTable(std::vector<QMDDedge>());
+	QMDDresetOrder();
+	dynamicReorderingTreshold = DYNREORDERLIMIT;
+	approx_trigger = approx_threshold;
+	for(unsigned int i = 0; i < nqubits; i++) {
+		qubit_var[i] = i;
+	}
 	nqubits = 0;
 	circ.e = QMDDone;
 	QMDDincref(circ.e);
@@ -56,58 +73,218 @@ void Simulator::Reset() {
 	complex_limit = 10000;
 	gatecount = 0;
 	max_gates = 0x7FFFFFFF;
-	intermediate_measurement = false;
 	measurement_done = false;
+	fidelity = 1.0;
+	rng_stream = 0;
 }
 
 void Simulator::AddVariables(int add, std::string name) {
-	QMDDedge f = QMDDone;
+	// new qubits are placed above the existing ones (Kronecker product |0...0> x state),
+	// such that the decision diagram built so far is reused without renumbering its nodes;
+	// with a variable order set, they are moved down to their levels afterwards
+	QMDDedge f = circ.e;
 	QMDDedge edges[4];
 	edges[1]=edges[2]=edges[3]=QMDDzero;
 
 	for(int p=0;p<add;p++) {
 		edges[0] = f;
-		f = QMDDmakeNonterminal(p, edges);
-	}
-	if(circ.e.p != QMDDzero.p) {
-		f = AddVariablesRec(circ.e, f, add);
-		dag_edges.clear();
+		f = QMDDmakeNonterminal(nqubits+p, edges);
 	}
 	QMDDincref(f);
 	QMDDdecref(circ.e);
 	circ.e = f;
 
-	if(nqubits != 0) {
-		for(int i = nqubits-1; i >= 0; i--) {
-			strncpy(circ.line[i+add].variable, circ.line[i].variable, MAXSTRLEN);
-		}
-	}
 	for(int i = 0; i < add; i++) {
-		snprintf(circ.line[nqubits + add - 1 - i].variable, MAXSTRLEN , "%s[%d]",name.c_str(), i);
+		snprintf(circ.line[nqubits + i].variable, MAXSTRLEN , "%s[%d]",name.c_str(), i);
+		qubit_var[nqubits + i] = nqubits + i;
 	}
 
 	nqubits += add;
 	circ.n = nqubits;
 	if(!measurement_done) {
 		QMDDdecref(beforeMeasurement);
+		if(!variable_rank.empty() && retained_states.empty() && branch_states.empty()) {
+			PlaceVariables(nqubits - add);
+		}
 		beforeMeasurement = circ.e;
 		QMDDincref(beforeMeasurement);
 	}
 }
 
-QMDDedge Simulator::AddVariablesRec(QMDDedge e, QMDDedge t, int add) {
+void Simulator::SetVariableOrder(std::vector<int>& order) {
+	// order[l] is the qubit to be placed at level l (counted from the bottom)
+	variable_rank.assign(order.size(), 0);
+	for(unsigned int l = 0; l < order.size(); l++) {
+		variable_rank[order[l]] = l;
+	}
+}
 
-	if(e.p == QMDDtnode) {
-		if(e.w == 0) {
-			return QMDDzero;
+void Simulator::PlaceVariables(unsigned int first) {
+	// moves the qubits first..nqubits-1, which AddVariables put on top, down to the levels given by
+	// variable_rank (the qubits placed so far keep their relative order); the state has to be the
+	// only decision diagram kept alive
+	bool moved = false;
+	for(unsigned int q = first; q < nqubits && q < variable_rank.size(); q++) {
+		for(int l = QMDDinvorder[q]; l > 0; l--) {
+			int below = QMDDorder[l-1];
+			if(below >= (int)variable_rank.size() || variable_rank[below] < variable_rank[q]) {
+				break;
+			}
+			QMDDedge e = QMDDexchange(circ.e, l);
+			QMDDincref(e);
+			QMDDdecref(circ.e);
+			circ.e = e;
+			moved = true;
+		}
+	}
+	if(moved) {
+		QMDDgarbageCollect();
+		QMDDinitComputeTable();	// identity matrices cached for the old order are invalid now
+	}
+}
+
+static double SquaredMagnitude(uint64_t w) {
+	// |w|^2 of an entry of the complex table in double precision
+	double m = Cmag.find(w & 0x7FFFFFFF7FFFFFFFull)->second.toDouble();
+	return m * m;
+}
+
+double Simulator::AssignProbs(QMDDedge& e, std::vector<QMDDnodeptr>* nodes) {
+	// returns the squared norm of the vector e; the squared norm below each node is kept in scratch[0]
+	// and scratch[1] is cleared (QMDDscratchBegin() has to be called before the traversal)
+	// newly visited nodes are added to nodes (if given)
+	if(e.w == COMPLEX_ZERO) {
+		return 0.0;
+	}
+	if(QMDDterminal(e)) {
+		return SquaredMagnitude(e.w);
+	}
+	if(!QMDDscratchValid(e.p)) {
+		e.p->scratch[0] = AssignProbs(e.p->e[0], nodes) + AssignProbs(e.p->e[2], nodes); //+ AssignProbs(e.p->e[1]) + AssignProbs(e.p->e[3]);
+		e.p->scratch[1] = 0.0;
+		QMDDscratchMark(e.p);
+		if(nodes != NULL) {
+			nodes->push_back(e.p);
+		}
+	}
+	return SquaredMagnitude(e.w) * e.p->scratch[0];
+}
+
+void Simulator::Approximate() {
+	// removes the nodes contributing least to the norm of the state until approx_loss is reached
+
+	if(QMDDterminal(circ.e)) {
+		return;
+	}
+
+	std::vector<QMDDnodeptr> nodes;
+	QMDDscratchBegin();
+	double norm = AssignProbs(circ.e, &nodes);
+	if(norm == 0) {
+		return;
+	}
+
+	// probability of reaching each node from the root (the dual of AssignProbs) is accumulated in scratch[1]
+	std::vector<std::vector<QMDDnodeptr> > levels(QMDDinvorder[circ.e.p->v] + 1);
+	for(QMDDnodeptr p : nodes) {
+		levels[QMDDinvorder[p->v]].push_back(p);
+	}
+	circ.e.p->scratch[1] = SquaredMagnitude(circ.e.w);
+
+	std::vector<std::pair<double, QMDDnodeptr> > contribution;
+	for(int l = (int)levels.size() - 1; l >= 0; l--) {
+		for(QMDDnodeptr p : levels[l]) {
+			double up = p->scratch[1];
+			if(p != circ.e.p) {
+				contribution.push_back(std::make_pair(up * p->scratch[0] / norm, p));
+			}
+			for(int i = 0; i < MAXRADIX*MAXRADIX; i += MAXRADIX) {
+				if(p->e[i].w == COMPLEX_ZERO || QMDDterminal(p->e[i])) {
+					continue;
+				}
+				p->e[i].p->scratch[1] += up * SquaredMagnitude(p->e[i].w);
+			}
+		}
+	}
+
+	// the removed nodes are replaced by zero, which is kept in their scratch slots as the result of
+	// ApproximateRec (which memoizes its results there as well)
+	std::sort(contribution.begin(), contribution.end());
+	QMDDscratchBegin();
+	double lost = 0;
+	int removed = 0;
+	for(auto it = contribution.begin(); it != contribution.end(); it++) {
+		if(lost + it->first > approx_loss) {
+			break;
 		}
-		t.w = Cmul(e.w, t.w);
-		return t;
+		lost += it->first;
+		it->second->scratchEdge = QMDDzero;
+		QMDDscratchMark(it->second);
+		removed++;
+	}
+	if(removed == 0) {
+		return;
+	}
+
+	QMDDedge e = ApproximateRec(circ.e);
+
+	QMDDscratchBegin();
+	double p = AssignProbs(e);
+	if(p == 0) {
+		return;
+	}
+	e.w = Cmul(e.w, Cmake(mpreal(sqrt(norm / p)), mpreal(0)));
+	fidelity *= p / norm;
+
+	QMDDincref(e);
+	QMDDdecref(circ.e);
+	circ.e = e;
+
+	if(!measurement_done) {
+		QMDDdecref(beforeMeasurement);
+		beforeMeasurement = circ.e;
+		QMDDincref(beforeMeasurement);
 	}
 
-	std::map<QMDDnodeptr, QMDDedge>::iterator it = dag_edges.find(e.p);
-	if(it != dag_edges.end()) {
-		QMDDedge e2 = it->second;
+	QMDDgarbageCollect();
+}
+
+void Simulator::Reorder() {
+	// sifts the variables of the state (or permutes windows of adjacent levels); all other decision
+	// diagrams would become invalid with the new order, so this is only done if the state is the only
+	// one kept alive
+	if(!retained_states.empty() || !branch_states.empty() || !QMDDedgeEqual(beforeMeasurement, circ.e) || circ.n < 2) {
+		dynamicReorderingTreshold = ActiveNodeCount;
+		return;
+	}
+
+	auto t1 = std::chrono::high_resolution_clock::now();
+
+	QMDDdecref(beforeMeasurement);
+	if(reorder_window > 0) {
+		QMDDwindowPermute(circ.n, &circ.e, reorder_window, reorder_budget);
+	} else {
+		QMDDsiftExchange(circ.n, &circ.e);
+	}
+	beforeMeasurement = circ.e;
+	QMDDincref(beforeMeasurement);
+
+	dynamicReorderingTreshold = std::max(ActiveNodeCount, DYNREORDERLIMIT);
+	reorder_count++;
+	reorder_time += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t1).count();
+}
+
+QMDDedge Simulator::ApproximateRec(QMDDedge e) {
+	// the result for each node is memoized in its scratch edge (zero for removed nodes)
+	if(QMDDterminal(e) || e.w == COMPLEX_ZERO) {
+		return e;
+	}
+
+	if(QMDDscratchValid(e.p)) {
+		QMDDedge e2 = e.p->scratchEdge;
+		if(e2.w == COMPLEX_ZERO) {
+			return QMDDzero;
+		}
 		e2.w = Cmul(e.w, e2.w);
 		return e2;
 	}
@@ -115,46 +292,96 @@ QMDDedge Simulator::AddVariablesRec(QMDDedge e, QMDDedge t, int add) {
 	QMDDedge edges[MAXRADIX*MAXRADIX];
 
 	for(int i=0; i<MAXRADIX*MAXRADIX; i++) {
-		edges[i] = AddVariablesRec(e.p->e[i], t, add);
+		edges[i] = ApproximateRec(e.p->e[i]);
 	}
 
-	QMDDedge e2 = QMDDmakeNonterminal(e.p->v+add, edges);
-	dag_edges[e.p] = e2;
+	QMDDedge e2 = QMDDmakeNonterminal(e.p->v, edges);
+	e.p->scratchEdge = e2;
+	QMDDscratchMark(e.p);
 	e2.w = Cmul(e.w, e2.w);
 	return e2;
 }
 
-mpreal Simulator::AssignProbs(QMDDedge& e) {
-	std::unordered_map<uint64_t, mpreal>::iterator it2;
-	std::unordered_map<QMDDnodeptr, mpreal>::iterator it = probs.find(e.p);
-	if(it != probs.end()) {
-		it2 = Cmag.find(e.w & 0x7FFFFFFF7FFFFFFFull);
-		return it2->second * it2->second * it->second;
-	}
-	mpreal sum;
-	if(QMDDterminal(e)) {
-		sum = mpreal(1);
-	} else {
-		sum = AssignProbs(e.p->e[0]) + AssignProbs(e.p->e[2]); //+ AssignProbs(e.p->e[1]) + AssignProbs(e.p->e[3]);
-	}
-
-	probs.insert(std::pair<QMDDnodeptr, mpreal>(e.p, sum));
+double Simulator::Draw(uint64_t index) {
+	// returns the random number index in [0, 1) of the Philox stream of the current measurement history
+	uint32_t random[4];
+	rng.Generate(rng_stream, index, random);
+	return Philox4x32::ToDouble(random[0], random[1]);
+}
 
-	it2 = Cmag.find(e.w & 0x7FFFFFFF7FFFFFFFull);
+void Simulator::NextStream(int value) {
+	// appends the outcome value to the measurement history: later draws use the stream derived from the
+	// current one and value (counters with the two top bits set, unlike those of Draw and SampleStream)
+	uint32_t random[4];
+	rng.Generate(rng_stream, (3ull << 62) | (uint64_t)value, random);
+	rng_stream = ((uint64_t)random[0] << 32) | random[1];
+}
 
-	return it2->second * it2->second * sum;
+// shots of SampleAll that share the outcome of the levels above the current one
+struct SamplePrefix {
+	QMDDnodeptr p;
+	unsigned int shots;
+	uint64_t stream;		// Philox stream of the prefix
+	std::string outcome;	// bit v is the value of variable v
+};
+
+static uint64_t SampleStream(const Philox4x32& rng, uint64_t stream, int level, int value) {
+	// stream of the prefix extended by value at level; these counters have the top bit set,
+	// the draws of a split (PhiloxStream) do not
+	uint32_t random[4];
+	rng.Generate(stream, (1ull << 63) | ((uint64_t)level << 1) | (uint64_t)value, random);
+	return ((uint64_t)random[0] << 32) | random[1];
 }
 
-void Simulator::MeasureAll(bool reset_state) {
-	std::unordered_map<QMDDnodeptr, mpreal>::iterator it;
-	std::unordered_map<uint64_t, mpreal>::iterator it2;
+static void SampleSplit(const Philox4x32& rng, SamplePrefix& s, int level, std::vector<SamplePrefix>& next) {
+	// splits the shots of s binomially between the values of the variable at level
+	// the probability of the 0-successor of each node is kept in scratch[0] (AssignBranchProbs)
+	int v = QMDDorder[level];
+	bool skipped = s.p == QMDDtnode || s.p->v != v;
+	PhiloxStream draws(rng, s.stream);
+	unsigned int zeros = std::binomial_distribution<unsigned int>(s.shots, skipped ? 0.5 : s.p->scratch[0])(draws);
+	for(int i = 0; i < 2; i++) {
+		unsigned int shots = i == 0 ? zeros : s.shots - zeros;
+		if(shots == 0) {
+			continue;
+		}
+		next.push_back(SamplePrefix{skipped ? s.p : s.p->e[i * MAXRADIX].p, shots, SampleStream(rng, s.stream, level, i), s.outcome});
+		if(i == 1) {
+			next.back().outcome[v / 8] |= (char)(1 << (v % 8));
+		}
+	}
+}
 
-	probs.clear();
+static void SampleRec(const Philox4x32& rng, SamplePrefix& s, int level, std::vector<std::pair<std::string, unsigned int> >& outcomes) {
+	if(level < 0) {
+		outcomes.push_back(std::make_pair(s.outcome, s.shots));
+		return;
+	}
+	std::vector<SamplePrefix> next;
+	SampleSplit(rng, s, level, next);
+	for(auto it = next.begin(); it != next.end(); it++) {
+		SampleRec(rng, *it, level - 1, outcomes);
+	}
+}
 
-	mpreal p,p0,p1,tmp,w;
-	p = AssignProbs(circ.e);
+void Simulator::SampleAll(unsigned int shots, std::map<std::string, int>& counts) {
+	// measures all qubits shots times without changing the state
+	// branch probabilities are computed once, then the shots are split binomially down the decision diagram,
+	// so the cost is proportional to the number of distinct outcomes
+	// every split draws from the Philox stream of its outcome prefix (the measurement history, then the level
+	// and values chosen above), so the subtrees are sampled in parallel and the result does not depend on the
+	// number of threads
+	if(circ.e.w == COMPLEX_ZERO) {
+		std::cerr << "ERROR: numerical instabilities led to a 0-vector! Abort simulation!" << std::endl;
+		exit(1);
+	}
+	QMDDscratchBegin();
+	double p = AssignBranchProbs(circ.e.p);
+	int top = QMDDterminal(circ.e) ? -1 : QMDDinvorder[circ.e.p->v];
+	double w = Cmag[circ.e.w & 0x7FFFFFFF7FFFFFFFull].toDouble();
+	p *= w * w * (double)(1ull << (circ.n - 1 - top));
 
-	if(abs(p -1) > epsilon) {
+	if(std::abs(p - 1) > epsilon.toDouble()) {
 		if(p == 0) {
 			std::cerr << "ERROR: numerical instabilities led to a 0-vector! Abort simulation!" << std::endl;
 			exit(1);
@@ -162,79 +389,145 @@ void Simulator::MeasureAll(bool reset_state) {
 		std::cerr << "WARNING in measurement: numerical instability occurred during simulation: |alpha|^2 + |beta|^2 = " << p << ", but should be 1!"<< std::endl;
 	}
 
-	QMDDedge cur = circ.e;
-	for(int i = QMDDinvorder[circ.e.p->v]; i >= 0;--i) {
-
-		it = probs.find(cur.p->e[0].p);
-		it2 = Cmag.find(cur.p->e[0].w & 0x7FFFFFFF7FFFFFFFull);
-		p0 = it->second * it2->second * it2->second;
-		it2 = Cmag.find(cur.p->e[1].w & 0x7FFFFFFF7FFFFFFFull);
-		it = probs.find(cur.p->e[1].p);
-		p0 += it->second * it2->second * it2->second;
+	int n = circ.n;
 
-		it = probs.find(cur.p->e[2].p);
-		it2 = Cmag.find(cur.p->e[2].w & 0x7FFFFFFF7FFFFFFFull);
-		p1 = it->second * it2->second * it2->second;
-		it = probs.find(cur.p->e[3].p);
-		it2 = Cmag.find(cur.p->e[3].w & 0x7FFFFFFF7FFFFFFFull);
-		p1 += it->second * it2->second * it2->second;
+	// split breadth-first until there are enough subtrees for the threads
+	std::vector<SamplePrefix> prefixes(1, SamplePrefix{circ.e.p, shots, rng_stream, std::string((n + 7) / 8, 0)});
+	int level = n - 1;
+	for(; level >= 0 && prefixes.size() < 4 * (unsigned int)QMDDthreads; level--) {
+		std::vector<SamplePrefix> next;
+		for(auto it = prefixes.begin(); it != prefixes.end(); it++) {
+			SampleSplit(rng, *it, level, next);
+		}
+		prefixes.swap(next);
+	}
 
-		it2 = Cmag.find(cur.w & 0x7FFFFFFF7FFFFFFFull);
+	std::vector<std::vector<std::pair<std::string, unsigned int> > > partial(prefixes.size());
+	QMDDparallelFor(prefixes.size(), [&](int i) {
+		SampleRec(rng, prefixes[i], level, partial[i]);
+	});
+
+	std::string outcome(n, '0');
+	for(auto it = partial.begin(); it != partial.end(); it++) {
+		for(auto it2 = it->begin(); it2 != it->end(); it2++) {
+			for(int q = 0; q < n; q++) {
+				int v = qubit_var[q];
+				outcome[q] = ((it2->first[v / 8] >> (v % 8)) & 1) ? '1' : '0';
+			}
+			counts[outcome] += it2->second;
+		}
+	}
 
-		mpreal tmp = p0 + p1;
-		p0 /= tmp;
-		p1 /= tmp;
+	measurement_done = true;
+}
 
-		mpreal n = mpreal(rand()) / RAND_MAX;
+double Simulator::AssignBranchProbs(QMDDnodeptr p) {
+	// returns the squared norm of the vector represented by node p
+	// the probability of the 0-successor is kept in scratch[0] and the squared norm in scratch[1]
+	if(p == QMDDtnode) {
+		return 1.0;
+	}
+	if(QMDDscratchValid(p)) {
+		return p->scratch[1];
+	}
 
-		if(n < p0) {
-			measurements[cur.p->v] = 0;
-			cur = cur.p->e[0];
-		} else {
-			measurements[cur.p->v] = 1;
-			cur = cur.p->e[2];
+	int l = QMDDinvorder[p->v];
+	double prob[2] = {0.0, 0.0};
+	for(int i = 0; i < 2; i++) {
+		QMDDedge e = p->e[i * MAXRADIX];
+		if(e.w == COMPLEX_ZERO) {
+			continue;
 		}
+		int child = QMDDterminal(e) ? -1 : QMDDinvorder[e.p->v];
+		prob[i] = SquaredMagnitude(e.w) * AssignBranchProbs(e.p) * (double)(1ull << (l - 1 - child));
 	}
 
-	if(reset_state) {
-		QMDDdecref(circ.e);
+	double sum = prob[0] + prob[1];
+	p->scratch[0] = sum > 0 ? prob[0] / sum : 1.0;
+	p->scratch[1] = sum;
+	QMDDscratchMark(p);
+	return sum;
+}
 
-		QMDDedge e = QMDDone;
-		QMDDedge edges[4];
-		edges[1]=edges[3]=QMDDzero;
+int Simulator::MeasureOne(int index) {
 
-		for(int p=0;p<circ.n;p++) {
-			if(measurements[p] == 0) {
-				edges[0] = e;
-				edges[2] = QMDDzero;
-			} else {
-				edges[0] = QMDDzero;
-				edges[2] = e;
-			}
-			e = QMDDmakeNonterminal(p, edges);
+	std::pair<mpreal, mpreal> probs = MeasurementProbabilities(index);
+	mpreal sum = probs.first + probs.second;
+
+	mpreal n = Draw(0);
+
+	int measurement = n < probs.first/sum ? 0 : 1;
+	NextStream(measurement);
+	CollapseQubit(index, measurement, measurement ? probs.second : probs.first);
+	return measurement;
+}
+
+std::vector<int> Simulator::MeasureQubits(std::vector<int>& qubits) {
+	// measures the given qubits jointly: a basis state is sampled by a single root-to-terminal walk
+	// (the squared norms below the nodes are memoized by AssignProbs), then the state is restricted
+	// to the outcome of the given qubits and renormalized
+
+	QMDDscratchBegin();
+	double p = AssignProbs(circ.e);
+	if(p == 0) {
+		std::cerr << "ERROR: numerical instabilities led to a 0-vector! Abort simulation!" << std::endl;
+		exit(1);
+	}
+
+	int values[MAXN];
+	QMDDedge cur = circ.e;
+	for(int level = circ.n - 1; level >= 0; level--) {
+		int v = QMDDorder[level];
+		double n = Draw(level);
+		if(QMDDterminal(cur) || cur.p->v != v) {
+			values[v] = n < 0.5 ? 0 : 1;
+			continue;
 		}
-		QMDDincref(e);
-		circ.e = e;
-		QMDDgarbageCollect();
-		cleanCtable(std::vector<QMDDedge>());
+		double p0 = AssignProbs(cur.p->e[0]);
+		double p1 = AssignProbs(cur.p->e[2]);
+		values[v] = n < p0 / (p0 + p1) ? 0 : 1;
+		cur = cur.p->e[values[v] * MAXRADIX];
 	}
-	probs.clear();
+
+	std::vector<int> outcome;
+	std::vector<bool> measured(circ.n, false);
+	for(auto it = qubits.begin(); it != qubits.end(); it++) {
+		outcome.push_back(values[qubit_var[*it]]);
+		measured[qubit_var[*it]] = true;
+		NextStream(outcome.back());
+	}
+	for(int v = 0; v < circ.n; v++) {
+		if(!measured[v]) {
+			values[v] = -1;
+		}
+	}
+
+#if VERBOSE
+	std::cout << "  -- measure " << qubits.size() << " qubits jointly" << std::endl;
+#endif
+
+	QMDDedge e = QMDDrestrict(circ.e, values);
+	QMDDscratchBegin();
+	double prob = AssignProbs(e);
+	QMDDincref(e);
+	QMDDdecref(circ.e);
+	circ.e = e;
+	circ.e.w = Cmul(e.w, Cmake(mpreal(sqrt(p / prob)), mpreal(0)));
 
 	measurement_done = true;
+	return outcome;
 }
 
-int Simulator::MeasureOne(int index) {
-
-	std::pair<mpreal, mpreal> probs = AssignProbsOne(circ.e, index);
+std::pair<mpreal, mpreal> Simulator::MeasurementProbabilities(int index) {
+	// probabilities of measuring 0 and 1 at the given qubit (warns on a denormalized state)
 
-	QMDDedge e = circ.e;
+	std::pair<mpreal, mpreal> probs = AssignProbsOne(circ.e, qubit_var[index]);
 
 #if VERBOSE
 	std::cout << "  -- measure qubit " << circ.line[index].variable << ": " << std::flush;
 #endif
 
 	mpreal sum = probs.first + probs.second;
-	mpreal norm_factor;
 
 	if(abs(sum - 1) > epsilon) {
 		if(sum == 0) {
@@ -248,48 +541,27 @@ int Simulator::MeasureOne(int index) {
 	std::cout << "p0 = " << probs.first << ", p1 = " << probs.second << std::flush;
 #endif
 
-	mpreal n = (mpreal(rand()) / RAND_MAX);
-
-	line[index] = 2;
-
-	QMDD_matrix measure_m;
-	measure_m[0][0] = measure_m[0][1] = measure_m[1][0] = measure_m[1][1] = COMPLEX_ZERO;
+	return probs;
+}
 
-	int measurement;
+void Simulator::CollapseQubit(int index, int outcome, mpreal prob) {
+	// restricts the given qubit to |outcome> and renormalizes by the outcome probability prob
 
-	if(n < probs.first/sum) {
 #if VERBOSE
-		std::cout << " -> measure 0" << std::endl;
+	std::cout << " -> measure " << outcome << std::endl;
 #endif
-		measure_m[0][0] = COMPLEX_ONE;
-		measurement = 0;
-		norm_factor = probs.first;
-	} else {
-#if VERBOSE
-		std::cout << " -> measure 1" << std::endl;
-#endif
-		measure_m[1][1] = COMPLEX_ONE;
-		measurement = 1;
-		norm_factor = probs.second;
-	}
-
-	QMDDedge f = QMDDmvlgate(measure_m, circ.n, line);
 
-	line[index] = -1;
-
-
-	e = QMDDmultiply(f,e);
-	QMDDdecref(circ.e);
+	QMDDedge e = QMDDrestrict(circ.e, qubit_var[index], outcome);
 	QMDDincref(e);
+	QMDDdecref(circ.e);
 	circ.e = e;
-	circ.e.w = e.w = Cmul(e.w, Cmake(sqrt(mpreal(1)/mpreal(norm_factor)), mpreal(0)));
+	circ.e.w = Cmul(e.w, Cmake(sqrt(mpreal(1)/prob), mpreal(0)));
 
 	measurement_done = true;
-	return measurement;
 }
 
 void Simulator::ResetQubit(int index) {
-	std::pair<mpreal, mpreal> probs = AssignProbsOne(circ.e, index);
+	std::pair<mpreal, mpreal> probs = AssignProbsOne(circ.e, qubit_var[index]);
 
 	QMDDedge e = circ.e;
 
@@ -298,7 +570,6 @@ void Simulator::ResetQubit(int index) {
 #endif
 
 	mpreal sum = probs.first + probs.second;
-	mpreal norm_factor;
 
 #if VERBOSE
 	std::cout << "p0 = " << probs.first << ", p1 = " << probs.second << std::flush;
@@ -310,106 +581,271 @@ void Simulator::ResetQubit(int index) {
 		exit(1);
 	}
 
-	line[index] = 2;
-
 	if(probs.first == 0) {
-		QMDDedge f = QMDDmvlgate(Nm, circ.n, line);
-		e = QMDDmultiply(f,e);
-		QMDDdecref(circ.e);
-		QMDDincref(e);
-		circ.e = e;
+		e = QMDDswapBranches(e, qubit_var[index]);
 		probs.first = mpreal(1);
 	}
 
-
-	QMDD_matrix measure_m;
-	measure_m[0][1] = measure_m[1][0] = measure_m[1][1] = COMPLEX_ZERO;
-	measure_m[0][0] = COMPLEX_ONE;
-	norm_factor = probs.first;
-
-	QMDDedge f = QMDDmvlgate(measure_m, circ.n, line);
-
-	line[index] = -1;
-
-	e = QMDDmultiply(f,e);
-	QMDDdecref(circ.e);
+	e = QMDDrestrict(e, qubit_var[index], 0);
 	QMDDincref(e);
+	QMDDdecref(circ.e);
 	circ.e = e;
-	circ.e.w = e.w = Cmul(e.w, Cmake(sqrt(mpreal(1)/mpreal(probs.first)), mpreal(0)));
+	circ.e.w = Cmul(e.w, Cmake(sqrt(mpreal(1)/probs.first), mpreal(0)));
+}
+
+bool Simulator::SwapQubits(int a, int b) {
+	// applies a SWAP gate by exchanging the decision diagram variables that represent qubits a and b,
+	// i.e., without any operation on the decision diagram; returns false (and the gate has to be
+	// applied) if states are retained for overlaps, since these refer to the previous assignment
+	if(!retained_states.empty()) {
+		return false;
+	}
+	gatecount++;
+	std::swap(qubit_var[a], qubit_var[b]);
+	return true;
 }
 
 std::pair<mpreal, mpreal> Simulator::AssignProbsOne(QMDDedge e, int index) {
-	probs.clear();
+	// probabilities of measuring 0 and 1 at variable index: the squared norms below the nodes are
+	// computed by AssignProbs, the probabilities of reaching the nodes above index are accumulated
+	// in scratch[1] in breadth-first order (a node is queued when it is reached for the first time)
+	QMDDscratchBegin();
 	AssignProbs(e);
-	std::queue<QMDDnodeptr> q;
-	mpreal pzero, pone;
-	pzero = pone = mpreal(0);
-	mpreal prob;
 
-	probsMone.clear();
-	visited_nodes2.clear();
+	std::vector<QMDDnodeptr> q;
+	q.push_back(e.p);
+	e.p->scratch[1] = SquaredMagnitude(e.w);
+	unsigned int head = 0;
+
+	while(head < q.size() && q[head]->v != index) {
+		QMDDnodeptr ptr = q[head++];
 
-	visited_nodes2.insert(e.p);
-	auto it2 = Cmag.find(e.w & 0x7FFFFFFF7FFFFFFFull);
-	probsMone[e.p] = it2->second * it2->second;
-	mpreal tmp1;
-	q.push(e.p);
+		for(int i = 0; i < MAXRADIX*MAXRADIX; i += MAXRADIX) {
+			if(ptr->e[i].w == COMPLEX_ZERO) {
+				continue;
+			}
+			double tmp1 = ptr->scratch[1] * SquaredMagnitude(ptr->e[i].w);
+			if(tmp1 == 0) {
+				continue;
+			}
+			if(ptr->e[i].p->scratch[1] == 0) {
+				q.push_back(ptr->e[i].p);
+			}
+			ptr->e[i].p->scratch[1] += tmp1;
+		}
+	}
 
-	while(q.front()->v != index) {
-		QMDDnodeptr ptr = q.front();
-		q.pop();
-		mpreal prob = probsMone[ptr];
+	double pzero = 0, pone = 0;
+	for(; head < q.size(); head++) {
+		QMDDnodeptr ptr = q[head];
 
 		if(ptr->e[0].w != COMPLEX_ZERO) {
-			auto it2 = Cmag.find(ptr->e[0].w & 0x7FFFFFFF7FFFFFFFull);
-			tmp1 = prob * it2->second * it2->second;
-
-			if(visited_nodes2.find(ptr->e[0].p) != visited_nodes2.end()) {
-				probsMone[ptr->e[0].p] = probsMone[ptr->e[0].p] + tmp1;
-			} else {
-				probsMone[ptr->e[0].p] = tmp1;
-				visited_nodes2.insert(ptr->e[0].p);
-				q.push(ptr->e[0].p);
-			}
+			pzero += ptr->scratch[1] * AssignProbs(ptr->e[0]);
 		}
 
 		if(ptr->e[2].w != COMPLEX_ZERO) {
-			auto it2 = Cmag.find(ptr->e[2].w & 0x7FFFFFFF7FFFFFFFull);
-			tmp1 = prob * it2->second * it2->second;
-
-			if(visited_nodes2.find(ptr->e[2].p) != visited_nodes2.end()) {
-				probsMone[ptr->e[2].p] = probsMone[ptr->e[2].p] + tmp1;
-			} else {
-				probsMone[ptr->e[2].p] = tmp1;
-				visited_nodes2.insert(ptr->e[2].p);
-				q.push(ptr->e[2].p);
-			}
+			pone += ptr->scratch[1] * AssignProbs(ptr->e[2]);
 		}
 	}
 
-	while(q.size() != 0) {
-		QMDDnodeptr ptr = q.front();
-		q.pop();
+	return std::make_pair(mpreal(pzero), mpreal(pone));
+}
 
-		if(ptr->e[0].w != COMPLEX_ZERO) {
-			auto it2 = Cmag.find(ptr->e[0].w & 0x7FFFFFFF7FFFFFFFull);
-			tmp1 = probsMone[ptr] * probs[ptr->e[0].p] * it2->second * it2->second;
-			pzero = pzero + tmp1;
+static std::complex<double> Cdouble(uint64_t w) {
+	// converts a complex value of the complex table to double precision
+	complex c = Cvalue(w);
+	double re = ((w >> 32) & 0x7FFFFFFFull) == 0 ? 0.0 : mpfr_get_d(c.r, MPFR_RNDN);
+	double im = (w & 0x7FFFFFFFull) == 0 ? 0.0 : mpfr_get_d(c.i, MPFR_RNDN);
+	return std::complex<double>((w >> 63) & 1 ? -re : re, (w >> 31) & 1 ? -im : im);
+}
+
+static std::complex<double> Csnap(std::complex<double> c) {
+	// mimics the complex table, which does not distinguish values closer than Ctol
+	double tol = Ctol.toDouble();
+	return std::complex<double>(std::abs(c.real()) < tol ? 0.0 : c.real(), std::abs(c.imag()) < tol ? 0.0 : c.imag());
+}
+
+void Simulator::GetStatevector(std::vector<int>& qubits, std::complex<double>* amplitudes) {
+	// writes all amplitudes by a single depth-first expansion of the state
+	// qubits[0] is the most significant bit of the index, qubits must contain all qubits
+	unsigned long long len = 1ull << qubits.size();
+	for(unsigned long long i = 0; i < len; i++) {
+		amplitudes[i] = 0;
+	}
+	for(unsigned int i = 0; i < qubits.size(); i++) {
+		statevector_bit[qubit_var[qubits[i]]] = 1ull << (qubits.size() - 1 - i);
+	}
+	if(circ.e.w == COMPLEX_ZERO) {
+		return;
+	}
+	GetStatevectorRec(circ.e.p, Cdouble(circ.e.w), nqubits, 0, amplitudes);
+
+	for(unsigned long long i = 0; i < len; i++) {
+		amplitudes[i] = Csnap(amplitudes[i]);
+	}
+}
+
+void Simulator::GetMarginalProbabilities(std::vector<int>& qubits, double* probabilities) {
+	// computes the joint distribution of the given qubits in one bottom-up pass, all other qubits are summed out
+	// qubits[0] is the most significant bit of the index
+	unsigned long long len = 1ull << qubits.size();
+	for(unsigned long long i = 0; i < len; i++) {
+		probabilities[i] = 0;
+	}
+	if(circ.e.w == COMPLEX_ZERO) {
+		return;
+	}
+
+	std::vector<int> vars;
+	for(auto it = qubits.begin(); it != qubits.end(); it++) {
+		vars.push_back(qubit_var[*it]);
+	}
+	marginal_selected.assign(nqubits, false);
+	marginal_rank.assign(nqubits + 1, 0);
+	for(auto it = vars.begin(); it != vars.end(); it++) {
+		marginal_selected[QMDDinvorder[*it]] = true;
+	}
+	std::vector<unsigned long long> bit;	// position in the result for the j-th lowest selected level
+	for(unsigned int l = 0; l < nqubits; l++) {
+		marginal_rank[l+1] = marginal_rank[l] + (marginal_selected[l] ? 1 : 0);
+		if(marginal_selected[l]) {
+			int pos = std::find(vars.begin(), vars.end(), QMDDorder[l]) - vars.begin();
+			bit.push_back(1ull << (qubits.size() - 1 - pos));
 		}
+	}
 
-		if(ptr->e[2].w != COMPLEX_ZERO) {
-			auto it2 = Cmag.find(ptr->e[2].w & 0x7FFFFFFF7FFFFFFFull);
-			tmp1 = probsMone[ptr] * probs[ptr->e[2].p] * it2->second * it2->second;
-			pone = pone + tmp1;
+	std::vector<double> lifted;
+	QMDDscratchBegin();
+	const std::vector<double>& root = MarginalLift(MarginalRec(circ.e.p), QMDDterminal(circ.e) ? -1 : QMDDinvorder[circ.e.p->v], nqubits - 1, lifted);
+	double w = Cmag[circ.e.w & 0x7FFFFFFF7FFFFFFFull].toDouble();
+	w *= w;
+
+	for(unsigned long long i = 0; i < root.size(); i++) {
+		unsigned long long index = 0;
+		for(unsigned int j = 0; j < bit.size(); j++) {
+			if((i >> j) & 1) {
+				index |= bit[j];
+			}
+		}
+		probabilities[index] = w * root[i];
+	}
+	marginals.clear();
+}
+
+std::vector<double>& Simulator::MarginalRec(QMDDnodeptr p) {
+	// the distribution below each node is memoized in marginals, at the index kept in its scratch slot
+	if(QMDDscratchValid(p)) {
+		return marginals[p->scratchIndex];
+	}
+	p->scratchIndex = marginals.size();
+	QMDDscratchMark(p);
+	if(p == QMDDtnode) {
+		marginals.push_back(std::vector<double>(1, 1.0));
+		return marginals.back();
+	}
+
+	int l = QMDDinvorder[p->v];
+	marginals.push_back(std::vector<double>(1ull << marginal_rank[l+1], 0.0));
+	std::vector<double>& result = marginals.back();
+	std::vector<double> lifted;
+	for(int i = 0; i < MAXRADIX*MAXRADIX; i += MAXRADIX) {
+		if(p->e[i].w == COMPLEX_ZERO) {
+			continue;
 		}
+		// references into marginals (a deque) stay valid while further nodes are appended
+		const std::vector<double>& child = MarginalLift(MarginalRec(p->e[i].p), p->e[i].p == QMDDtnode ? -1 : QMDDinvorder[p->e[i].p->v], l - 1, lifted);
+		double w = Cmag[p->e[i].w & 0x7FFFFFFF7FFFFFFFull].toDouble();
+		w *= w;
+		unsigned long long offset = marginal_selected[l] ? (unsigned long long)(i / MAXRADIX) << marginal_rank[l] : 0;
+		for(unsigned long long j = 0; j < child.size(); j++) {
+			result[offset + j] += w * child[j];
+		}
+	}
+	return result;
+}
+
+const std::vector<double>& Simulator::MarginalLift(const std::vector<double>& v, int from, int to, std::vector<double>& lifted) {
+	// expands the distribution of a node at level from to level to, as AssignBranchProbs both values of a
+	// skipped level have the amplitudes of the node: a selected level duplicates the distribution, an
+	// unselected one doubles the mass
+	// returns v if no level is skipped and the expanded distribution in lifted otherwise
+	if(to <= from) {
+		return v;
+	}
+	int copies = marginal_rank[to+1] - marginal_rank[from+1];
+	double scale = (double)(1ull << (to - from - copies));
+	unsigned long long n = v.size();
+	lifted.resize(n << copies);
+	for(unsigned long long j = 0; j < lifted.size(); j++) {
+		lifted[j] = scale * v[j % n];
+	}
+	return lifted;
+}
+
+void Simulator::GetSparseStatevector(std::vector<int>& qubits, double threshold, std::vector<std::pair<std::string, std::complex<double> > >& amplitudes) {
+	// collects the amplitudes with magnitude of at least threshold as (basis state, amplitude) pairs
+	// qubits[0] is the leftmost character of the basis states, qubits must contain all qubits
+	// since edge weights have magnitude at most one (normalization __NormC__), paths are
+	// pruned as soon as their accumulated weight falls below the threshold
+	for(unsigned int i = 0; i < qubits.size(); i++) {
+		statevector_pos[qubit_var[qubits[i]]] = i;
+	}
+	if(circ.e.w == COMPLEX_ZERO) {
+		return;
 	}
+	std::string key(qubits.size(), '0');
+	GetSparseStatevectorRec(circ.e.p, Cdouble(circ.e.w), nqubits, key, std::max(threshold, Ctol.toDouble()), amplitudes);
+}
 
+void Simulator::GetSparseStatevectorRec(QMDDnodeptr p, std::complex<double> amp, int level, std::string& key, double threshold, std::vector<std::pair<std::string, std::complex<double> > >& amplitudes) {
+	if(std::abs(amp) < threshold) {
+		return;
+	}
+	if(level == 0) {
+		amplitudes.push_back(std::make_pair(key, Csnap(amp)));
+		return;
+	}
 
-	probs.clear();
-	probsMone.clear();
-	visited_nodes2.clear();
+	int v = QMDDorder[level-1];
+	if(p == QMDDtnode || p->v != v) {
+		// skipped variable
+		GetSparseStatevectorRec(p, amp, level-1, key, threshold, amplitudes);
+		key[statevector_pos[v]] = '1';
+		GetSparseStatevectorRec(p, amp, level-1, key, threshold, amplitudes);
+		key[statevector_pos[v]] = '0';
+		return;
+	}
 
-	return std::make_pair(pzero, pone);
+	if(p->e[0].w != COMPLEX_ZERO) {
+		GetSparseStatevectorRec(p->e[0].p, amp * Cdouble(p->e[0].w), level-1, key, threshold, amplitudes);
+	}
+	if(p->e[2].w != COMPLEX_ZERO) {
+		key[statevector_pos[v]] = '1';
+		GetSparseStatevectorRec(p->e[2].p, amp * Cdouble(p->e[2].w), level-1, key, threshold, amplitudes);
+		key[statevector_pos[v]] = '0';
+	}
+}
+
+void Simulator::GetStatevectorRec(QMDDnodeptr p, std::complex<double> amp, int level, unsigned long long index, std::complex<double>* amplitudes) {
+	if(level == 0) {
+		amplitudes[index] = amp;
+		return;
+	}
+
+	int v = QMDDorder[level-1];
+	if(p == QMDDtnode || p->v != v) {
+		// skipped variable
+		GetStatevectorRec(p, amp, level-1, index, amplitudes);
+		GetStatevectorRec(p, amp, level-1, index | statevector_bit[v], amplitudes);
+		return;
+	}
+
+	if(p->e[0].w != COMPLEX_ZERO) {
+		GetStatevectorRec(p->e[0].p, amp * Cdouble(p->e[0].w), level-1, index, amplitudes);
+	}
+	if(p->e[2].w != COMPLEX_ZERO) {
+		GetStatevectorRec(p->e[2].p, amp * Cdouble(p->e[2].w), level-1, index | statevector_bit[v], amplitudes);
+	}
 }
 
 uint64_t Simulator::GetElementOfVector(unsigned long long element) {
@@ -421,7 +857,7 @@ uint64_t Simulator::GetElementOfVector(unsigned long long element) {
 	do {
 		l = Cmul(l, e.w);
 		//cout << "variable q" << QMDDinvorder[e.p->v] << endl;
-		unsigned long long tmp = (element >> QMDDinvorder[e.p->v]) & 1;
+		unsigned long long tmp = (element >> e.p->v) & 1;
 		e = e.p->e[2*tmp];
 		//element = element % (int)pow(MAXRADIX, QMDDinvorder[e.p->v]+1);
 	} while(!QMDDterminal(e));
@@ -430,45 +866,63 @@ uint64_t Simulator::GetElementOfVector(unsigned long long element) {
 	return l;
 }
 
-mpreal Simulator::GetProbabilityRec(QMDDedge& e) {
-
-	std::unordered_map<uint64_t, mpreal>::iterator it2;
-	std::unordered_map<QMDDnodeptr, mpreal>::iterator it = probs.find(e.p);
-	if(it != probs.end()) {
-		it2 = Cmag.find(e.w & 0x7FFFFFFF7FFFFFFFull);
-		return it2->second * it2->second * it->second;
+double Simulator::GetProbabilityRec(QMDDedge& e) {
+	// squared norm of the part of e selected by line (0/1: fixed value, otherwise both), memoized in scratch[0]
+	if(e.w == COMPLEX_ZERO) {
+		return 0.0;
 	}
-	mpreal sum;
 	if(QMDDterminal(e)) {
-		sum = mpreal(1);
-	} else if(line[e.p->v] == 0) {
-		sum = GetProbabilityRec(e.p->e[0]);
-	} else if(line[e.p->v] == 1) {
-		sum = GetProbabilityRec(e.p->e[2]);
-	} else {
-		sum = GetProbabilityRec(e.p->e[0]) + GetProbabilityRec(e.p->e[2]); //+ AssignProbs(e.p->e[1]) + AssignProbs(e.p->e[3]);
+		return SquaredMagnitude(e.w);
 	}
-
-	probs.insert(std::pair<QMDDnodeptr, mpreal>(e.p, sum));
-
-	it2 = Cmag.find(e.w & 0x7FFFFFFF7FFFFFFFull);
-
-	return it2->second * it2->second * sum;
+	if(!QMDDscratchValid(e.p)) {
+		double sum;
+		if(line[e.p->v] == 0) {
+			sum = GetProbabilityRec(e.p->e[0]);
+		} else if(line[e.p->v] == 1) {
+			sum = GetProbabilityRec(e.p->e[2]);
+		} else {
+			sum = GetProbabilityRec(e.p->e[0]) + GetProbabilityRec(e.p->e[2]); //+ AssignProbs(e.p->e[1]) + AssignProbs(e.p->e[3]);
+		}
+		e.p->scratch[0] = sum;
+		QMDDscratchMark(e.p);
+	}
+	return SquaredMagnitude(e.w) * e.p->scratch[0];
 }
 
 
 mpreal Simulator::GetProbability() {
-	mpreal result = GetProbabilityRec(circ.e);
-	probs.clear();
-	return result;
+	QMDDscratchBegin();
+	return mpreal(GetProbabilityRec(circ.e));
 }
 
 void Simulator::ApplyGate(QMDDedge gate) {
 	gatecount++;
+	UpdateState(QMDDmultiply(gate, circ.e));
+}
+
+void Simulator::ApplyPermutation(uint64_t phase) {
+	// applies X to the target of line[] under its controls by rearranging the edges of the state
+	// (QMDDpermute) and multiplies the state by the given global phase
+	gatecount++;
+	QMDDedge tmp = QMDDpermute(circ.e, line, circ.n);
+	tmp.w = Cmul(tmp.w, phase);
+	UpdateState(tmp);
+}
 
-	QMDDedge tmp;
+void Simulator::ApplyDiagonal(std::vector<int>& qubits, std::vector<uint64_t>& d) {
+	// multiplies the state by a diagonal gate on the given qubits; d[x] is the entry for the basis
+	// state x of the qubits (bit j is the value of qubits[j])
+	gatecount++;
+	int pos[MAXN];
+	std::fill(pos, pos + circ.n, -1);
+	for(unsigned int j = 0; j < qubits.size(); j++) {
+		pos[qubit_var[qubits[j]]] = j;
+	}
+	UpdateState(QMDDdiagonal(circ.e, pos, d.data(), qubits.size(), circ.n));
+}
 
-	tmp = QMDDmultiply(gate, circ.e);
+void Simulator::UpdateState(QMDDedge tmp) {
+	// makes tmp the current state after a gate
 	QMDDincref(tmp);
 	QMDDdecref(circ.e);
 	circ.e = tmp;
@@ -485,21 +939,29 @@ void Simulator::ApplyGate(QMDDedge gate) {
 		max_active = ActiveNodeCount;
 	}
 
+	if(reorder_factor > 0 && ActiveNodeCount > reorder_factor * dynamicReorderingTreshold) {
+		Reorder();
+	}
+
+	if(approx_threshold > 0 && ActiveNodeCount > approx_trigger) {
+		Approximate();
+		// if the allowed loss did not reduce the state below the threshold, wait until it grew again
+		// (like dynamicReorderingTreshold) instead of approximating after every gate
+		approx_trigger = std::max(approx_threshold, APPROXGROWTH * ActiveNodeCount);
+	}
+
 	if(Ctable.size() > complex_limit) {
-		std::vector<QMDDedge> v;
+		std::vector<QMDDedge> v(retained_states);
+		v.insert(v.end(), branch_states.begin(), branch_states.end());
 		v.push_back(circ.e);
 		v.push_back(beforeMeasurement);
 
-		cleanCtable(v);
+		CleanComplexTable(v);
 		v.clear();
 		if(complex_limit < 2*Ctable.size()) {
 			complex_limit *= 2;
 		}
 	}
-
-	if(measurement_done) {
-		intermediate_measurement = true;
-	}
 }
 
 void Simulator::ApplyGate(QMDD_matrix& m) {
@@ -507,6 +969,178 @@ void Simulator::ApplyGate(QMDD_matrix& m) {
 	ApplyGate(f);
 }
 
+std::vector<double> Simulator::ExpectationValues(std::vector<std::string>& paulis) {
+	// returns <psi|P|psi> for every Pauli string P (character i is the operator applied to qubit i)
+	std::vector<double> result;
+	std::map<std::pair<int, char>, int> children;
+
+	std::vector<int> var_qubit(nqubits);
+	for(unsigned int q = 0; q < nqubits; q++) {
+		var_qubit[qubit_var[q]] = q;
+	}
+
+	pauli_trie.clear();
+	pauli_trie.push_back({'I', -1, 0});
+	QMDDscratchBegin();
+	pauli_ids = 0;
+	pauli_entries = 0;
+	pauli_memo.assign(std::max(pauli_memo.size(), (size_t)1024), PauliEntry{0, 0, 0, 0});
+
+	for(auto it = paulis.begin(); it != paulis.end(); it++) {
+		int t = 0;
+		for(unsigned int l = 0; l < nqubits; l++) {
+			char op = (*it)[var_qubit[QMDDorder[l]]];
+			auto child = children.find(std::make_pair(t, op));
+			if(child == children.end()) {
+				pauli_trie.push_back({op, t, (int)l+1});
+				child = children.insert(std::make_pair(std::make_pair(t, op), (int)pauli_trie.size()-1)).first;
+			}
+			t = child->second;
+		}
+
+		uint64_t v = PauliRec(circ.e, circ.e, t);
+		complex c = Cvalue(v);
+		double re = ((v >> 32) == 0) ? 0.0 : mpfr_get_d(c.r, MPFR_RNDN);
+		result.push_back(((v >> 63) & 1) ? -re : re);
+	}
+
+	pauli_trie.clear();
+	return result;
+}
+
+uint64_t Simulator::PauliRec(QMDDedge x, QMDDedge y, int t) {
+	if(x.w == COMPLEX_ZERO || y.w == COMPLEX_ZERO) {
+		return COMPLEX_ZERO;
+	}
+
+	uint64_t weight = Cmul(Conj(x.w), y.w);
+	if(t == 0) {
+		return weight;
+	}
+
+	x.w = y.w = COMPLEX_ONE;
+	uint32_t idx = PauliId(x.p), idy = PauliId(y.p);
+	PauliEntry& entry = PauliSlot(idx, idy, t);
+	if(entry.x != 0) {
+		return Cmul(entry.value, weight);
+	}
+
+	int w = QMDDorder[pauli_trie[t].level - 1];
+	QMDDedge x0 = x, x1 = x, y0 = y, y1 = y;
+	if(!QMDDterminal(x) && x.p->v == w) {
+		x0 = x.p->e[0];
+		x1 = x.p->e[2];
+	}
+	if(!QMDDterminal(y) && y.p->v == w) {
+		y0 = y.p->e[0];
+		y1 = y.p->e[2];
+	}
+
+	int c = pauli_trie[t].parent;
+	uint64_t r;
+	switch(pauli_trie[t].op) {
+	case 'X':
+		r = Cadd(PauliRec(x0, y1, c), PauliRec(x1, y0, c));
+		break;
+	case 'Y':
+		r = Cmul(Csub(PauliRec(x1, y0, c), PauliRec(x0, y1, c)), Cmake(mpreal(0), mpreal(1)));
+		break;
+	case 'Z':
+		r = Csub(PauliRec(x0, y0, c), PauliRec(x1, y1, c));
+		break;
+	default:
+		r = Cadd(PauliRec(x0, y0, c), PauliRec(x1, y1, c));
+		break;
+	}
+
+	// the recursion may have moved entry, so its slot is looked up again (after growing the table such
+	// that at most half of it is used)
+	if(2 * (pauli_entries + 1) > pauli_memo.size()) {
+		std::vector<PauliEntry> old(2 * pauli_memo.size(), PauliEntry{0, 0, 0, 0});
+		old.swap(pauli_memo);
+		for(auto it = old.begin(); it != old.end(); it++) {
+			if(it->x != 0) {
+				PauliSlot(it->x - 1, it->y - 1, it->t) = *it;
+			}
+		}
+	}
+	PauliSlot(idx, idy, t) = PauliEntry{idx + 1, idy + 1, t, r};
+	pauli_entries++;
+	return Cmul(r, weight);
+}
+
+uint32_t Simulator::PauliId(QMDDnodeptr p) {
+	// numbers the nodes of the state in the order in which PauliRec reaches them
+	if(!QMDDscratchValid(p)) {
+		p->scratchIndex = pauli_ids++;
+		QMDDscratchMark(p);
+	}
+	return (uint32_t)p->scratchIndex;
+}
+
+Simulator::PauliEntry& Simulator::PauliSlot(uint32_t x, uint32_t y, int t) {
+	// returns the entry of pauli_memo for the key or the empty entry at which it belongs (linear probing)
+	uint64_t h = ((uint64_t)x * 0x9E3779B97F4A7C15ull) ^ ((uint64_t)y * 0xC2B2AE3D27D4EB4Full) ^ ((uint64_t)t * 0x165667B19E3779F9ull);
+	size_t mask = pauli_memo.size() - 1;
+	for(size_t i = (h ^ (h >> 29)) & mask;; i = (i + 1) & mask) {
+		PauliEntry& entry = pauli_memo[i];
+		if(entry.x == 0 || (entry.x == x + 1 && entry.y == y + 1 && entry.t == t)) {
+			return entry;
+		}
+	}
+}
+
+void Simulator::RetainState(QMDDedge e) {
+	QMDDincref(e);
+	retained_states.push_back(e);
+}
+
+void Simulator::RetainWeight(uint64_t w) {
+	retained_weights.insert(w);
+}
+
+void Simulator::CleanComplexTable(std::vector<QMDDedge> edges) {
+	// removes all complex values that are neither weights of the given edges nor retained
+	for(auto it = retained_weights.begin(); it != retained_weights.end(); it++) {
+		QMDDedge e;
+		e.p = QMDDtnode;
+		e.w = *it;
+		edges.push_back(e);
+	}
+	cleanCtable(edges);
+}
+
+void Simulator::SaveState(BranchState& s) {
+	// saves the current state; states have to be restored in reverse order of saving
+	s.e = circ.e;
+	s.beforeMeasurement = beforeMeasurement;
+	s.measurement_done = measurement_done;
+	s.nqubits = nqubits;
+	s.fidelity = fidelity;
+	s.qubit_var.assign(qubit_var, qubit_var + nqubits);
+	s.rng_stream = rng_stream;
+	QMDDincref(s.e);
+	QMDDincref(s.beforeMeasurement);
+	branch_states.push_back(s.e);
+	branch_states.push_back(s.beforeMeasurement);
+}
+
+void Simulator::RestoreState(BranchState& s) {
+	// returns to a state saved by SaveState() (takes over its references)
+	QMDDdecref(circ.e);
+	QMDDdecref(beforeMeasurement);
+	circ.e = s.e;
+	beforeMeasurement = s.beforeMeasurement;
+	measurement_done = s.measurement_done;
+	nqubits = s.nqubits;
+	circ.n = nqubits;
+	fidelity = s.fidelity;
+	std::copy(s.qubit_var.begin(), s.qubit_var.end(), qubit_var);
+	rng_stream = s.rng_stream;
+	branch_states.pop_back();
+	branch_states.pop_back();
+}
+
 void Simulator::ResetBeforeMeasurement() {
 	QMDDdecref(circ.e);
 	circ.e = beforeMeasurement;
@@ -29,15 +29,19 @@ by citing the following publication:
 #include <QMDDcore.h>
 #include <QMDDpackage.h>
 #include <QMDDcomplex.h>
+#include <Philox.h>
 #include <map>
 #include <set>
 #include <unordered_map>
 #include <queue>
+#include <deque>
+#include <complex>
 
 #include <gmp.h>
 #include <mpreal.h>
 
 #define VERBOSE 0
+#define APPROXGROWTH 2	// after an approximation round, approximate again once the state grew by this factor
 
 
 class Simulator {
@@ -55,44 +59,156 @@ public:
 	int GetMaxActive() {
 		return max_active;
 	}
+	void SetApproximation(int threshold, double loss) {
+		approx_threshold = threshold;
+		approx_trigger = threshold;
+		approx_loss = loss;
+	}
+	bool IsApproximating() {
+		return approx_threshold > 0;
+	}
+	double GetFidelity() {
+		return fidelity;
+	}
+	void SetReorderFactor(double factor) {
+		reorder_factor = factor;
+	}
+	void SetReorderWindow(int size, double budget) {
+		reorder_window = size;
+		reorder_budget = budget;
+	}
+	int GetReorderCount() {
+		return reorder_count;
+	}
+	double GetReorderTime() {
+		return reorder_time;
+	}
+	void SetVariableOrder(std::vector<int>& order);
+	void SetSeed(uint64_t seed) {
+		rng = Philox4x32(seed);
+	}
 	virtual ~Simulator();
 
 protected:
 	int MeasureOne(int index);
-	void MeasureAll(bool reset_state=true);
+	std::vector<int> MeasureQubits(std::vector<int>& qubits);
+	std::pair<mpreal, mpreal> MeasurementProbabilities(int index);
+	void CollapseQubit(int index, int outcome, mpreal prob);
+	void SampleAll(unsigned int shots, std::map<std::string, int>& counts);
 	void ApplyGate(QMDD_matrix& m);
 	void ApplyGate(QMDDedge gate);
+	void ApplyPermutation(uint64_t phase);
+	void ApplyDiagonal(std::vector<int>& qubits, std::vector<uint64_t>& d);
 	void AddVariables(int add, std::string name);
 	void ResetQubit(int index);
+	bool SwapQubits(int a, int b);
 	mpreal GetProbability();
+	double Draw(uint64_t index);
+	void NextStream(int value);
 
-	int line[MAXN];
+	int line[MAXN];			// per decision diagram variable
+	int qubit_var[MAXN];	// decision diagram variable representing each qubit (changed by SwapQubits)
 	int measurements[MAXN];
 	unsigned int nqubits = 0;
 	QMDDrevlibDescription circ;
 
-	bool intermediate_measurement = false;
+	Philox4x32 rng{0};			// random numbers of measurements and sampling, keyed by --seed
+	uint64_t rng_stream = 0;	// Philox stream of the measurement outcomes so far
+
 	void ResetBeforeMeasurement();
 
 	uint64_t GetElementOfVector(unsigned long long element);
+	void GetStatevector(std::vector<int>& qubits, std::complex<double>* amplitudes);
+	void GetMarginalProbabilities(std::vector<int>& qubits, double* probabilities);
+	void GetSparseStatevector(std::vector<int>& qubits, double threshold, std::vector<std::pair<std::string, std::complex<double> > >& amplitudes);
+
+	std::vector<double> ExpectationValues(std::vector<std::string>& paulis);
+
+	void RetainState(QMDDedge e);
+	std::vector<QMDDedge> retained_states;	// states kept alive (e.g., for overlaps between snapshots) until Reset()
+	void RetainWeight(uint64_t w);
+	std::set<uint64_t> retained_weights;	// complex values kept in the complex table (e.g., of compiled gates), also by Reset()
+
+	// simulation state saved at a branch point (e.g., when shots split at a measurement)
+	struct BranchState {
+		QMDDedge e;
+		QMDDedge beforeMeasurement;
+		bool measurement_done;
+		unsigned int nqubits;
+		double fidelity;
+		std::vector<int> qubit_var;
+		uint64_t rng_stream;
+	};
+	void SaveState(BranchState& s);
+	void RestoreState(BranchState& s);
 private:
 
-	mpreal GetProbabilityRec(QMDDedge& e);
-	QMDDedge AddVariablesRec(QMDDedge e, QMDDedge t, int add);
-	mpreal AssignProbs(QMDDedge& e);
+	double GetProbabilityRec(QMDDedge& e);
+	double AssignProbs(QMDDedge& e, std::vector<QMDDnodeptr>* nodes = NULL);
 	std::pair<mpreal, mpreal> AssignProbsOne(QMDDedge e, int index);
-
-	std::unordered_map<QMDDnodeptr, mpreal> probs;
-	std::map<QMDDnodeptr,mpreal> probsMone;
-	std::set<QMDDnodeptr> visited_nodes2;
-	std::map<QMDDnodeptr, QMDDedge> dag_edges;
+	void GetStatevectorRec(QMDDnodeptr p, std::complex<double> amp, int level, unsigned long long index, std::complex<double>* amplitudes);
+	void GetSparseStatevectorRec(QMDDnodeptr p, std::complex<double> amp, int level, std::string& key, double threshold, std::vector<std::pair<std::string, std::complex<double> > >& amplitudes);
+	double AssignBranchProbs(QMDDnodeptr p);
+	std::vector<double>& MarginalRec(QMDDnodeptr p);
+	const std::vector<double>& MarginalLift(const std::vector<double>& v, int from, int to, std::vector<double>& lifted);
+	uint64_t PauliRec(QMDDedge x, QMDDedge y, int t);
+	void UpdateState(QMDDedge tmp);
+	void CleanComplexTable(std::vector<QMDDedge> edges);
+	void Approximate();
+	void Reorder();
+	void PlaceVariables(unsigned int first);
+	QMDDedge ApproximateRec(QMDDedge e);
+
+	// Pauli strings are stored as a trie over the levels (bottom-up), such that strings
+	// agreeing on the lower qubits share their node ids and thus their memoized results
+	struct PauliTrieNode {
+		char op;
+		int parent;
+		int level;
+	};
+	// results of PauliRec, memoized in an open-addressing table keyed by the trie node and the ids
+	// that the nodes of the state keep in their scratch slots (PauliId)
+	struct PauliEntry {
+		uint32_t x, y;	// ids plus one (0: empty entry)
+		int t;
+		uint64_t value;
+	};
+	uint32_t PauliId(QMDDnodeptr p);
+	PauliEntry& PauliSlot(uint32_t x, uint32_t y, int t);
+
+	unsigned long long statevector_bit[MAXN];	// position of each variable in the index of the exported state vector
+	int statevector_pos[MAXN];					// position of each variable in the keys of the sparse state vector
+
+	// marginal distributions of the selected variables below the nodes, whose scratch slots hold their
+	// positions (bit j of the index into a distribution corresponds to the j-th lowest selected level)
+	std::deque<std::vector<double> > marginals;
+	std::vector<bool> marginal_selected;	// per level
+	std::vector<int> marginal_rank;		// per level: number of selected levels below
+
+	std::vector<PauliTrieNode> pauli_trie;
+	std::vector<PauliEntry> pauli_memo;	// size is a power of two
+	unsigned int pauli_entries = 0;
+	unsigned int pauli_ids = 0;
 
 	int max_active = 0;
 	unsigned int complex_limit = 10000;
 	int gatecount = 0;
 	int max_gates = 0x7FFFFFFF;
 
+	int approx_threshold = 0;		// approximate once more nodes are active (0 disables approximation)
+	int approx_trigger = 0;			// current limit: approx_threshold or a multiple of the nodes left by the last round
+	double approx_loss = 0.001;		// fidelity that may be lost in a single approximation round
+	double fidelity = 1.0;			// product of the fidelities of all approximation rounds
+
+	double reorder_factor = 0;		// reorder once the number of active nodes grew by this factor (0 disables reordering)
+	int reorder_window = 0;			// permute windows of this many levels instead of sifting (0: sifting)
+	double reorder_budget = 0;		// seconds after which window permutation stops (0: no limit)
+	int reorder_count = 0;
+	double reorder_time = 0;		// seconds spent on reordering
+	std::vector<int> variable_rank;	// level at which each qubit is placed by AddVariables (empty: declaration order)
+
 	bool measurement_done = false;
+	std::vector<QMDDedge> branch_states;	// states saved by SaveState() and not yet restored
 	mpreal epsilon;
 	QMDDedge beforeMeasurement;
 };
@@ -63,6 +63,7 @@ DEALINGS IN THE SOFTWARE.
 #include <QMDDcore.h>
 #include <QMDDpackage.h>
 #include <QMDDcomplex.h>
+#include <QMDDparallel.h>
 
 #include <Simulator.h>
 //#include <QASMscanner.hpp>
@@ -84,7 +85,19 @@ int main(int argc, char** argv) {
 		("ps", "print simulation stats (applied gates, sim. time, and maximal size of the DD)")
 		("display_statevector", "adds the state-vector to snapshots")
 		("display_probabilities", "adds the probabilities of the basis states to snapshots")
+		("sparse_statevector", po::value<double>()->implicit_value(0), "adds the nonzero amplitudes (optionally only those with at least the given magnitude) as basis state/amplitude pairs to snapshots")
+		("binary_statevector", po::value<string>(), "writes the state-vectors of snapshots as raw little-endian complex128 values to the given file (e.g., /dev/fd/3) instead of the output")
+		("display_overlaps", "adds the overlaps and fidelities with all previous snapshots to snapshots")
 		("precision", po::value<double>(), "two numbers are treated to be equal if their difference is smaller than this value")
+		("threads", po::value<int>(), "number of threads used for sampling the shots (default: 1)")
+		("approx_threshold", po::value<int>(), "approximate the state whenever more nodes are active (default: 0, i.e., exact simulation)")
+		("approx_loss", po::value<double>(), "fidelity that may be lost in a single approximation round (default: 0.001)")
+		("qubit_order", po::value<string>(), "initial order of the qubits in the decision diagram: declaration (default) or interaction (reverse Cuthill-McKee on the interactions of the gates)")
+		("generic_gates", "apply all gates by decision diagram multiplication, also SWAP gates, (controlled) X gates that only permute the basis states and diagonal gates")
+		("parameter_precision", po::value<string>(), "precision in which gate parameters and matrices are evaluated: mpfr (default, the precision of the complex table) or double")
+		("reorder_factor", po::value<double>(), "sift the variable order whenever the number of active nodes grew by this factor since the last reordering (default: 0, i.e., no reordering)")
+		("reorder_window", po::value<int>(), "reorder by trying all orders of this many (2-4) adjacent levels instead of sifting (default: 0, i.e., sifting)")
+		("reorder_budget", po::value<double>(), "seconds after which a window reordering stops (default: 5, 0: no limit)")
 	;
 
 	po::variables_map vm;
@@ -101,8 +114,6 @@ int main(int argc, char** argv) {
 		seed = vm["seed"].as<unsigned long>();
 	}
 
-	srand(seed);
-
 	QMDDinit(0);
 
 	if (vm.count("precision")) {
@@ -112,6 +123,10 @@ int main(int argc, char** argv) {
 		Ctol = mpreal(vm["precision"].as<double>());
 	}
 
+	if (vm.count("threads")) {
+		QMDDinitThreads(vm["threads"].as<int>());
+	}
+
 	Simulator* simulator;
 
 	if (vm.count("simulate_qasm")) {
@@ -121,11 +136,62 @@ int main(int argc, char** argv) {
 		} else {
 			simulator = new QASMsimulator(fname, vm.count("display_statevector"), vm.count("display_probabilities"));
 		}
+		static_cast<QASMsimulator*>(simulator)->SetDisplayOverlaps(vm.count("display_overlaps"));
+		static_cast<QASMsimulator*>(simulator)->SetGenericGates(vm.count("generic_gates"));
+		if (vm.count("sparse_statevector")) {
+			static_cast<QASMsimulator*>(simulator)->SetSparseStatevector(vm["sparse_statevector"].as<double>());
+		}
+		if (vm.count("binary_statevector")) {
+			static_cast<QASMsimulator*>(simulator)->SetBinaryStatevector(vm["binary_statevector"].as<string>());
+		}
+		if (vm.count("qubit_order")) {
+			string order = vm["qubit_order"].as<string>();
+			if (order != "declaration" && order != "interaction") {
+				cerr << "Unknown qubit order '" << order << "'!" << endl;
+				exit(1);
+			}
+			static_cast<QASMsimulator*>(simulator)->SetInteractionOrder(order == "interaction");
+		}
+		if (vm.count("parameter_precision")) {
+			string precision = vm["parameter_precision"].as<string>();
+			if (precision != "mpfr" && precision != "double") {
+				cerr << "Unknown parameter precision '" << precision << "'!" << endl;
+				exit(1);
+			}
+			static_cast<QASMsimulator*>(simulator)->SetDoubleParameters(precision == "double");
+		}
 	} else {
 		cout << description << "\n";
 	    return 1;
 	}
 
+	simulator->SetSeed(seed);
+
+	if (vm.count("approx_threshold")) {
+		double loss = 0.001;
+		if (vm.count("approx_loss")) {
+			loss = vm["approx_loss"].as<double>();
+		}
+		simulator->SetApproximation(vm["approx_threshold"].as<int>(), loss);
+	}
+
+	if (vm.count("reorder_factor")) {
+		simulator->SetReorderFactor(vm["reorder_factor"].as<double>());
+	}
+
+	if (vm.count("reorder_window")) {
+		int size = vm["reorder_window"].as<int>();
+		if (size < 0 || size == 1 || size > 4) {
+			cerr << "Window size has to be between 2 and 4 (or 0 for sifting)!" << endl;
+			exit(1);
+		}
+		double budget = 5;
+		if (vm.count("reorder_budget")) {
+			budget = vm["reorder_budget"].as<double>();
+		}
+		simulator->SetReorderWindow(size, budget);
+	}
+
     auto t1 = chrono::high_resolution_clock::now();
 
 	if(vm.count("shots")) {
@@ -137,14 +203,17 @@ int main(int argc, char** argv) {
 	auto t2 = chrono::high_resolution_clock::now();
 	chrono::duration<float> diff = t2-t1;
 
-	delete simulator;
-
 	if (vm.count("ps")) {
 		cout << endl << "SIMULATION STATS: " << endl;
 		cout << "  Number of applied gates: " << simulator->GetGatecount() << endl;
 		cout << "  Simulation time: " << diff.count() << " seconds" << endl;
 		cout << "  Maximal size of DD (number of nodes) during simulation: " << simulator->GetMaxActive() << endl;
+		cout << "  Number of variable reorderings: " << simulator->GetReorderCount() << " (" << simulator->GetReorderTime() << " seconds)" << endl;
 	}
 
+	delete simulator;
+
+	QMDDshutdownThreads();
+
 	return 0;
 }
@@ -0,0 +1,31 @@
+# -*- coding: utf-8 -*-
+
+# Copyright 2018, IBM.
+#
+# This source code is licensed under the Apache License, Version 2.0 found in
+# the LICENSE.txt file in the root directory of this source tree.
+
+"""Runs QASM programs directly on the JKU exe, e.g. to use snapshot labels or
+command line options that cannot be expressed as a qobj."""
+
+import json
+import os
+
+from qiskit_jku_provider import QasmSimulator
+from qiskit_jku_provider.qasm_simulator_jku import JKUSimulatorWrapper, qelib1
+
+
+def run_qasm(qasm, options=(), shots=1, seed=1, additional_output_data=()):
+    """Simulates the QASM program with the given command line options and returns the parsed
+    (JKU ordered) output"""
+    wrapper = JKUSimulatorWrapper(QasmSimulator(silent=True).executable, silent=True)
+    wrapper.shots = shots
+    wrapper.seed = seed
+    wrapper.additional_output_data = list(additional_output_data)
+    wrapper.options = list(options)
+    with open("qelib1.inc", "w") as qelib_file:
+        qelib_file.write(qelib1)
+    try:
+        return json.loads(wrapper.run(qasm))
+    finally:
+        os.remove("qelib1.inc")
@@ -0,0 +1,127 @@
+# -*- coding: utf-8 -*-
+
+# Copyright 2018, IBM.
+#
+# This source code is licensed under the Apache License, Version 2.0 found in
+# the LICENSE.txt file in the root directory of this source tree.
+
+# pylint: disable=missing-docstring
+
+"""Test the gates that are not applied by a multiplication (SWAP gates, permutations and
+diagonal gates) against --generic_gates."""
+
+import unittest
+
+import numpy
+from scipy.stats import chi2_contingency
+
+from .common import QiskitTestCase
+from ._jku_qasm import run_qasm
+
+HEADER = 'OPENQASM 2.0;\ninclude "qelib1.inc";\n'
+
+
+class TestSpecialGatesJKU(QiskitTestCase):
+    """Compares the results with those of --generic_gates."""
+
+    def assertSameAsGeneric(self, qasm, shots=1000):
+        data = ['probabilities']
+        actual = run_qasm(HEADER + qasm, shots=shots, additional_output_data=data)
+        expected = run_qasm(HEADER + qasm, ['--generic_gates'], shots=shots,
+                            additional_output_data=data)
+
+        self.assertEqual(set(actual.get('snapshots', {})), set(expected.get('snapshots', {})))
+        for key, snapshot_expected in expected.get('snapshots', {}).items():
+            snapshot = actual['snapshots'][key]
+            with self.subTest(snapshot=key):
+                self.assertEqual(set(snapshot), set(snapshot_expected))
+                for amplitude, amplitude_expected in zip(snapshot.get('statevector', []),
+                                                         snapshot_expected.get('statevector', [])):
+                    self.assertAlmostEqual(complex(amplitude.replace('i', 'j')),
+                                           complex(amplitude_expected.replace('i', 'j')), places=5)
+                for name in ['probabilities', 'expectation_values']:
+                    for value, value_expected in zip(snapshot.get(name, []),
+                                                     snapshot_expected.get(name, [])):
+                        self.assertAlmostEqual(value, value_expected, places=5)
+
+        counts, counts_expected = actual['counts'], expected['counts']
+        self.log.info('%s %s', counts, counts_expected)
+        if len(counts_expected) == 1:
+            self.assertEqual(counts, counts_expected)
+        else:
+            states = counts.keys() | counts_expected.keys()
+            ctable = numpy.array([[counts.get(key, 0) for key in states],
+                                  [counts_expected.get(key, 0) for key in states]])
+            self.assertGreater(chi2_contingency(ctable)[1], 0.01)
+
+    def test_swap_before_measure(self):
+        self.assertSameAsGeneric('qreg q[3];\ncreg c[3];\n'
+                                 'x q[0];\nh q[1];\nswap q[0],q[2];\ncx q[1],q[0];\n'
+                                 'measure q[0] -> c[0];\nmeasure q[2] -> c[2];\n')
+
+    def test_swap_before_intermediate_measure(self):
+        self.assertSameAsGeneric('qreg q[3];\ncreg c[3];\n'
+                                 'x q[0];\nry(0.4) q[1];\nswap q[0],q[1];\nmeasure q[0] -> c[0];\n'
+                                 'swap q[0],q[2];\nif(c==1) x q[1];\nmeasure q -> c;\n')
+
+    def test_swap_before_snapshot(self):
+        self.assertSameAsGeneric('qreg q[3];\n'
+                                 'x q[0];\nry(0.3) q[1];\nh q[2];\nswap q[0],q[1];\n'
+                                 'snapshot(1) q[0],q[1],q[2];\nswap q[1],q[2];\ncx q[0],q[2];\n'
+                                 'snapshot(2) q[2],q[0],q[1];\n'
+                                 'snapshot(3) "ZII, IZI, IIZ, XXI" q[0],q[1],q[2];\n')
+
+    @staticmethod
+    def adder(prepare, bits=3):
+        # ripple-carry adder (Cuccaro et al.) of a and b into b, with ccx of qelib1.inc
+        lines = ['gate maj a,b,c { cx c,b; cx c,a; ccx a,b,c; }',
+                 'gate uma a,b,c { ccx a,b,c; cx c,a; cx a,b; }',
+                 'qreg cin[1];', 'qreg a[{}];'.format(bits), 'qreg b[{}];'.format(bits),
+                 'qreg cout[1];', prepare,
+                 'maj cin[0],b[0],a[0];']
+        lines += ['maj a[{0}],b[{1}],a[{1}];'.format(i - 1, i) for i in range(1, bits)]
+        lines.append('cx a[{}],cout[0];'.format(bits - 1))
+        lines += ['uma a[{0}],b[{1}],a[{1}];'.format(i - 1, i) for i in reversed(range(1, bits))]
+        lines.append('uma cin[0],b[0],a[0];')
+        return '\n'.join(lines) + '\n'
+
+    def test_adder(self):
+        # 5 + 6 = 11, i.e., b = 3 and a carry (counts are q[0] first: cin, a, b, cout)
+        qasm = self.adder('x a[0];\nx a[2];\nx b[1];\nx b[2];')
+        self.assertEqual(run_qasm(HEADER + qasm, shots=10)['counts'], {'01011101': 10})
+        self.assertSameAsGeneric(qasm)
+
+    def test_adder_superposition(self):
+        qasm = self.adder('h a;\nh b[0];\nry(0.7) b[2];')
+        qasm += 'snapshot(1) cin[0],a[0],a[1],a[2],b[0],b[1],b[2],cout[0];\n'
+        self.assertSameAsGeneric(qasm)
+
+    def test_negative_controls(self):
+        self.assertSameAsGeneric('gate ncx a,b,c { x a; ccx a,b,c; x a; }\n'
+                                 'gate nncx a,b,c { x a; x b; ccx a,b,c; x b; x a; }\n'
+                                 'gate ncz a,b { x a; cz a,b; x a; }\n'
+                                 'qreg q[4];\n'
+                                 'h q[0];\nry(0.9) q[1];\nncx q[0],q[1],q[2];\n'
+                                 'snapshot(1) q[0],q[1],q[2],q[3];\n'
+                                 'nncx q[2],q[0],q[3];\nh q[3];\nncz q[3],q[1];\n'
+                                 'snapshot(2) q[0],q[1],q[2],q[3];\n')
+
+    def test_precise_weights(self):
+        # angles that lose digits in double precision: the entries of diagonal gates and the phase
+        # of permutations are evaluated in the precision of the complex table, as by --generic_gates
+        angle = '200000000000000*pi+pi/2'
+        qasm = ('gate bigcu1 a,b {{ cu1({0}) a,b; }}\n'
+                'gate phcx a,b {{ u1({0}) a; cx a,b; u1(-({0})) a; }}\n'
+                'qreg q[3];\n'
+                'h q[0];\nh q[1];\nh q[2];\ncu1({0}) q[0],q[1];\nbigcu1 q[1],q[2];\n'
+                'phcx q[2],q[0];\nrz({0}) q[1];\n'
+                'snapshot(1) q[0],q[1],q[2];\n').format(angle)
+        actual = run_qasm(HEADER + qasm)
+        expected = run_qasm(HEADER + qasm, ['--generic_gates'])
+        self.assertEqual(actual['snapshots']['1']['statevector'],
+                         expected['snapshots']['1']['statevector'])
+        self.assertSameAsGeneric(qasm)
+
+
+if __name__ == '__main__':
+    unittest.main(verbosity=2)
@@ -7,12 +7,24 @@
 
 # pylint: disable=missing-docstring,broad-except
 
+import math
 import unittest
 from qiskit import QuantumCircuit, QuantumRegister
 from qiskit import execute
 
 from .common import QiskitTestCase
 from qiskit_jku_provider import QasmSimulator
+from ._jku_qasm import run_qasm
+
+BELL_QASM = """OPENQASM 2.0;
+include "qelib1.inc";
+qreg q[2];
+snapshot(1) q[0],q[1];
+h q[0];
+cx q[0],q[1];
+snapshot(2) q[0],q[1];
+snapshot(3) q[0],q[1];
+"""
 
 
 class JKUSnapshotTest(QiskitTestCase):
@@ -39,5 +51,98 @@ class JKUSnapshotTest(QiskitTestCase):
         self.assertAlmostEqual((abs(actual[3]))**2, 1/2, places=5)
 
 
+class JKUSnapshotOverlapTest(QiskitTestCase):
+    """Test the overlaps and fidelities between snapshots (--display_overlaps)."""
+
+    def test_bell_overlaps(self):
+        output = run_qasm(BELL_QASM, ['--display_overlaps'])
+        snapshots = output['snapshots']
+        self.assertNotIn('overlaps', snapshots['1'])
+        self.assertEqual(set(snapshots['2']['overlaps']), {'1'})
+        self.assertEqual(set(snapshots['3']['overlaps']), {'1', '2'})
+
+        # <00|Bell> = 1/sqrt(2), up to the global phase of h
+        overlap = complex(snapshots['2']['overlaps']['1'].replace('i', 'j'))
+        self.assertAlmostEqual(abs(overlap), 1 / math.sqrt(2), places=5)
+        self.assertAlmostEqual(snapshots['2']['fidelities']['1'], 0.5, places=5)
+        self.assertAlmostEqual(snapshots['3']['fidelities']['1'], 0.5, places=5)
+
+        # <Bell|Bell> = 1
+        overlap = complex(snapshots['3']['overlaps']['2'].replace('i', 'j'))
+        self.assertAlmostEqual(overlap, 1, places=5)
+        self.assertAlmostEqual(snapshots['3']['fidelities']['2'], 1, places=5)
+
+    def test_overlaps_with_later_register(self):
+        # the qubits of a register declared after a snapshot are |0> in it
+        qasm = ('OPENQASM 2.0;\nqreg a[1];\nU(pi/2,0,pi) a[0];\nsnapshot(1) a[0];\n'
+                'qreg b[1];\nU(pi/2,0,pi) b[0];\nsnapshot(2) a[0],b[0];\n'
+                'U(pi/2,0,pi) b[0];\nU(pi,0,pi) b[0];\nsnapshot(3) a[0],b[0];\n')
+        snapshots = run_qasm(qasm, ['--display_overlaps'])['snapshots']
+        overlap = complex(snapshots['2']['overlaps']['1'].replace('i', 'j'))
+        self.assertAlmostEqual(abs(overlap), 1 / math.sqrt(2), places=5)
+        self.assertAlmostEqual(snapshots['2']['fidelities']['1'], 0.5, places=5)
+        self.assertAlmostEqual(snapshots['3']['fidelities']['1'], 0, places=5)
+        self.assertAlmostEqual(snapshots['3']['fidelities']['2'], 0.5, places=5)
+
+
+BELL_PREP = 'h q[0];\ncx q[0],q[1];\n'
+
+
+class JKUPauliSnapshotTest(QiskitTestCase):
+    """Test Pauli expectation value snapshots."""
+
+    def expectation(self, pauli, prep=''):
+        qasm = ('OPENQASM 2.0;\ninclude "qelib1.inc";\nqreg q[2];\n' + prep +
+                'snapshot(1) "{}" q[0],q[1];\n'.format(pauli))
+        return run_qasm(qasm)['snapshots']['1']
+
+    def test_bell_expectation_values(self):
+        snapshot = self.expectation('ZZ, XX, YY, ZI', BELL_PREP)
+        for actual, expected in zip(snapshot['expectation_values'], [1, 1, -1, 0]):
+            self.assertAlmostEqual(actual, expected, places=5)
+        self.assertAlmostEqual(snapshot['expectation_value'], 1, places=5)
+
+    def test_weighted_sum(self):
+        snapshot = self.expectation('0.5 ZZ, -0.25 XX, 2 YY', BELL_PREP)
+        for actual, expected in zip(snapshot['expectation_values'], [1, 1, -1]):
+            self.assertAlmostEqual(actual, expected, places=5)
+        self.assertAlmostEqual(snapshot['expectation_value'], 0.5 - 0.25 - 2, places=5)
+
+    def test_qubit_order(self):
+        # the first letter of a Pauli string acts on the first listed qubit
+        snapshot = self.expectation('ZI, IZ', 'x q[0];\n')
+        self.assertEqual(len(snapshot['expectation_values']), 2)
+        self.assertAlmostEqual(snapshot['expectation_values'][0], -1, places=5)
+        self.assertAlmostEqual(snapshot['expectation_values'][1], 1, places=5)
+
+
+class JKUReorderSnapshotTest(QiskitTestCase):
+    """Test snapshots with dynamic variable reordering (--reorder_factor)."""
+
+    @staticmethod
+    def layered_circuit(n, layers):
+        # large enough (about 500 nodes) for the state to be sifted once
+        lines = ['OPENQASM 2.0;', 'include "qelib1.inc";', 'qreg q[{}];'.format(n)]
+        lines += ['h q[{}];'.format(i) for i in range(n)]
+        for layer in range(layers):
+            for i in range(n):
+                lines.append('ry({:.3f}) q[{}];'.format(0.1 + 0.37 * ((7 * i + 3 * layer) % 11), i))
+                lines.append('t q[{}];'.format(i))
+            for i in range(layer % 2, n - 1, 2):
+                target = (5 * i + layer + 1) % n
+                lines.append('cx q[{}],q[{}];'.format(i, target if target != i else (i + 1) % n))
+        lines.append('snapshot(1) {};'.format(','.join('q[{}]'.format(i) for i in range(n))))
+        return '\n'.join(lines) + '\n'
+
+    def test_sifted_statevector(self):
+        qasm = self.layered_circuit(9, 3)
+        expected = run_qasm(qasm)['snapshots']['1']['statevector']
+        actual = run_qasm(qasm, ['--reorder_factor', '1.01'])['snapshots']['1']['statevector']
+        self.assertEqual(len(actual), 2**9)
+        for amplitude, amplitude_expected in zip(actual, expected):
+            self.assertAlmostEqual(complex(amplitude.replace('i', 'j')),
+                                   complex(amplitude_expected.replace('i', 'j')), places=5)
+
+
 if __name__ == '__main__':
     unittest.main()
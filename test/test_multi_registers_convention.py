@@ -15,6 +15,8 @@ from qiskit import execute
 from qiskit.quantum_info import state_fidelity, basis_state
 from qiskit.test import QiskitTestCase
 from qiskit_jku_provider import QasmSimulator
+from qiskit_jku_provider.qasm_simulator_jku import JKUSimulatorWrapper
+from ._jku_qasm import run_qasm
 
 
 class TestCircuitMultiRegs(QiskitTestCase):
@@ -49,3 +51,24 @@ class TestCircuitMultiRegs(QiskitTestCase):
 
         self.assertEqual(counts, target)
         self.assertAlmostEqual(state_fidelity(basis_state('0110', 4), state), 1.0, places=7)
+
+    def test_sparse_snapshot_multi(self):
+        """Test the keys of sparse snapshots (statevector_ket) of multi regs.
+        """
+        qasm = """OPENQASM 2.0;
+include "qelib1.inc";
+qreg q0[2];
+qreg q1[2];
+x q0[0];
+x q1[0];
+h q1[1];
+snapshot(1) q0[0],q0[1],q1[0],q1[1];
+"""
+        output = run_qasm(qasm, additional_output_data=['statevector_ket'])
+        ket = JKUSimulatorWrapper().convert_statevector_ket(
+            output['snapshots']['1']['statevector_ket'])
+
+        # keys in Qiskit order, i.e., q1[1] q1[0] q0[1] q0[0]
+        self.assertEqual(set(ket), {'0101', '1101'})
+        for amplitude in ket.values():
+            self.assertAlmostEqual(abs(complex(*amplitude))**2, 1/2, places=5)
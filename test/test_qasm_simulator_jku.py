@@ -5,11 +5,13 @@
 # This source code is licensed under the Apache License, Version 2.0 found in
 # the LICENSE.txt file in the root directory of this source tree.
 
+import collections
+import math
 import random
 import unittest
 
 import numpy
-from scipy.stats import chi2_contingency
+from scipy.stats import chi2_contingency, chisquare
 
 from qiskit import execute
 from qiskit import QuantumCircuit
@@ -27,6 +29,7 @@ else:
 
 
 from ._random_circuit_generator import RandomCircuitGenerator
+from ._jku_qasm import run_qasm
 from .common import QiskitTestCase
 
 
@@ -158,5 +161,86 @@ class TestQasmSimulatorJKU(QiskitTestCase):
                 self.assertGreater(result[1], 0.01)
 
 
+@unittest.skipIf(_skip_class, 'JKU C++ simulator unavailable')
+class TestIntermediateMeasurementsJKU(QiskitTestCase):
+    """
+    Test circuits that continue after a measurement (counts are in JKU order, q[0] first).
+    """
+
+    header = 'OPENQASM 2.0;\ninclude "qelib1.inc";\nqreg q[2];\ncreg c[2];\n'
+
+    def assertDistribution(self, body, expected, shots=1000):
+        # several seeds are checked per circuit, hence the lower significance level
+        for seed in [1, 2]:
+            counts = run_qasm(self.header + body, shots=shots, seed=seed)['counts']
+            self.log.info(counts)
+            with self.subTest(seed=seed):
+                self.assertEqual(set(counts), set(expected))
+                if len(expected) > 1:
+                    result = chisquare([counts[key] for key in expected],
+                                       [shots * p for p in expected.values()])
+                    self.assertGreater(result[1], 0.001)
+
+    def test_measure_if(self):
+        self.assertDistribution('h q[0];\nmeasure q[0] -> c[0];\nif(c==1) x q[1];\n',
+                                {'00': 0.5, '11': 0.5})
+
+    def test_measure_if_not(self):
+        self.assertDistribution('h q[0];\nmeasure q[0] -> c[0];\nif(c==0) x q[1];\n',
+                                {'01': 0.5, '10': 0.5})
+
+    def test_measure_reset(self):
+        # the counts are the measured values, the reset only affects later gates
+        self.assertDistribution('h q[0];\nmeasure q[0] -> c[0];\nreset q[0];\n',
+                                {'00': 0.5, '10': 0.5})
+        self.assertDistribution('h q[0];\nmeasure q[0] -> c[0];\nreset q[0];\nx q[0];\n',
+                                {'10': 1.0})
+
+    def test_measure_swap(self):
+        self.assertDistribution('x q[0];\nh q[1];\nmeasure q[1] -> c[1];\nswap q[0],q[1];\n',
+                                {'01': 0.5, '11': 0.5})
+
+    @staticmethod
+    def measured_samples(measure, copies=8, seeds=range(1, 11)):
+        # single shots of several copies of an entangled register q{k}: after measure (formatted
+        # with k), the classical register is copied into a{k}, which makes the measurement
+        # intermediate and shows the measured values next to the collapsed state in the counts
+        copy = ['if(c{0}==%d) x a{0}[%d];' % (value, j)
+                for value in range(8) for j in range(3) if (value >> j) & 1]
+        lines = ['OPENQASM 2.0;', 'include "qelib1.inc";']
+        for k in range(copies):
+            lines += [line.format(k) for line in
+                      ['qreg q{0}[3];', 'qreg a{0}[3];', 'creg c{0}[3];', 'h q{0}[0];',
+                       'cx q{0}[0],q{0}[1];', 'ry(1.1) q{0}[2];', 'cx q{0}[1],q{0}[2];', measure]
+                      + copy]
+        samples = []
+        for seed in seeds:
+            key, = run_qasm('\n'.join(lines) + '\n', seed=seed)['counts']
+            samples += [(key[6 * k:6 * k + 3], key[6 * k + 3:6 * k + 6]) for k in range(copies)]
+        return samples
+
+    def test_measure_register(self):
+        # a register measured at once (a single walk for all qubits) and qubit by qubit
+        expected = {'000': 0.5 * math.cos(0.55) ** 2, '001': 0.5 * math.sin(0.55) ** 2,
+                    '110': 0.5 * math.sin(0.55) ** 2, '111': 0.5 * math.cos(0.55) ** 2}
+        joint = self.measured_samples('measure q{0} -> c{0};')
+        single = self.measured_samples('measure q{0}[0] -> c{0}[0];\nmeasure q{0}[1] -> c{0}[1];\n'
+                                       'measure q{0}[2] -> c{0}[2];')
+        for name, samples in [('joint', joint), ('single', single)]:
+            counts = collections.Counter(measured for measured, _ in samples)
+            self.log.info('%s %s', name, counts)
+            with self.subTest(measure=name):
+                # the state collapses to the measured values
+                for measured, copied in samples:
+                    self.assertEqual(measured, copied)
+                self.assertLessEqual(set(counts), set(expected))
+                result = chisquare([counts[key] for key in expected],
+                                   [len(samples) * p for p in expected.values()])
+                self.assertGreater(result[1], 0.001)
+        ctable = numpy.array([[collections.Counter(m for m, _ in samples)[key] for key in expected]
+                              for samples in [joint, single]])
+        self.assertGreater(chi2_contingency(ctable)[1], 0.001)
+
+
 if __name__ == '__main__':
     unittest.main(verbosity=2)